@@ -0,0 +1,116 @@
+/*
+ * alloccheck.c
+ *
+ * Check that editing and redisplay make no allocations once warmed up.
+ * Scripted edits are typed a key at a time into an instance whose memory
+ * comes from a counting allocator, at widths where the line fits and
+ * where it wraps.  The first lines grow the buffers, and any allocation
+ * while the same lines are edited again is a failure.
+ *
+ * usage: tinyrl_alloccheck
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyrl.h"
+#include "history.h"
+
+#define WARMUP 3
+#define LINES 20
+
+/* typing, moving, killing and yanking, deleting and recalling history */
+static const char script[] =
+	"show interface ethernet0 counters"
+	"\x1b[D\x1b[D\x0b\x19\x01\x05\x7f\x7fxy"
+	"\x1b[A\x1b[B"
+	" and a longer tail which wraps at the narrower widths\x01\x04\x05\r";
+
+struct check {
+	unsigned long allocs;
+	size_t pos;
+};
+
+static void *count_malloc(void *context, size_t size)
+{
+	((struct check *)context)->allocs++;
+	return malloc(size);
+}
+
+static void *count_realloc(void *context, void *ptr, size_t size)
+{
+	((struct check *)context)->allocs++;
+	return realloc(ptr, size);
+}
+
+static void count_free(void *context, void *ptr)
+{
+	free(ptr);
+}
+
+/* a key at a time, so that every key is redisplayed */
+static int check_read(void *context, char *buf, size_t len, bool block)
+{
+	struct check *check = context;
+	size_t n = 0;
+
+	if (!script[check->pos])
+		return block ? -1 : 0;
+	if (!block && check->pos && script[check->pos - 1] != '\x1b'
+	    && script[check->pos - 1] != '[')
+		return 0;
+	buf[n++] = script[check->pos++];
+	return n;
+}
+
+static void check_write(void *context, const char *buf, size_t len)
+{
+}
+
+static unsigned long check_width(unsigned width)
+{
+	struct check check = { 0, 0 };
+	struct tinyrl_allocator alloc = {
+		count_malloc, count_realloc, count_free, &check
+	};
+	struct tinyrl *tinyrl;
+	struct tinyrl_history *history;
+	unsigned long allocs = 0;
+	unsigned i;
+
+	tinyrl = tinyrl_new_alloc(&alloc, check_read, check_write, &check);
+	if (!tinyrl)
+		return 1;
+	tinyrl_set_width(tinyrl, width);
+	history = tinyrl_history_new(tinyrl, 10);
+	tinyrl_history_add(history, "show running-config");
+	for (i = 0; i < WARMUP + LINES; i++) {
+		if (i == WARMUP)
+			allocs = check.allocs;
+		check.pos = 0;
+		if (!tinyrl_readline_ref(tinyrl, "> ", NULL))
+			break;
+	}
+	allocs = check.allocs - allocs;
+	if (i < WARMUP + LINES)
+		allocs++;	/* a lost line is a failure too */
+	tinyrl_history_delete(history);
+	tinyrl_delete(tinyrl);
+	return allocs;
+}
+
+int main(void)
+{
+	static const unsigned widths[] = { 20, 37, 80, 200 };
+	unsigned long allocs;
+	bool failed = false;
+	unsigned i;
+
+	for (i = 0; i < sizeof(widths) / sizeof(widths[0]); i++) {
+		allocs = check_width(widths[i]);
+		printf("{\"width\": %u, \"lines\": %u, \"allocs\": %lu}\n",
+		       widths[i], LINES, allocs);
+		if (allocs)
+			failed = true;
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,562 @@
+/*
+ * bench.c
+ *
+ * Microbenchmarks, printed one JSON object per line so that results can
+ * be collected and compared between builds.
+ *
+ * usage: tinyrl_bench [-t milliseconds] [name...]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tinyrl.h"
+#include "history.h"
+#include "complete.h"
+#include "pool.h"
+#include "usage.h"
+#include "utf8.h"
+
+struct bench_context {
+	struct tinyrl *tinyrl;
+	unsigned long allocs;
+
+	/* the keys which the instance reads */
+	const char *keys;
+	size_t keys_len;
+	size_t keys_pos;
+	unsigned long repeat;
+	bool entered;
+
+	/* the iterations for the next run */
+	unsigned long iterations;
+
+	/* made by the benchmark's setup, outside the time */
+	void *data;
+
+	/* the results */
+	uint64_t elapsed;
+	unsigned long run_allocs;
+	size_t output;
+	size_t run_output;
+};
+
+struct bench {
+	const char *name;
+	void (*run)(struct bench_context *ctx, unsigned long iterations);
+	const char *keys;	/* if set, run from a key handler after these */
+	bool no_alloc;		/* must not allocate once warmed up */
+	unsigned long arg;
+	void (*setup)(struct bench_context *ctx);	/* if set, untimed */
+	void (*teardown)(struct bench_context *ctx);
+};
+
+static const struct bench *current;
+static volatile size_t sink;
+
+static void *count_malloc(void *context, size_t size)
+{
+	((struct bench_context *)context)->allocs++;
+	return malloc(size);
+}
+
+static void *count_realloc(void *context, void *ptr, size_t size)
+{
+	((struct bench_context *)context)->allocs++;
+	return realloc(ptr, size);
+}
+
+static void count_free(void *context, void *ptr)
+{
+	free(ptr);
+}
+
+static int bench_read(void *context, char *buf, size_t len, bool block)
+{
+	struct bench_context *ctx = context;
+	size_t n = 0;
+
+	/* the keys are repeated, followed by the enter key */
+	while (n < len && ctx->repeat) {
+		buf[n++] = ctx->keys[ctx->keys_pos++];
+		if (ctx->keys_pos == ctx->keys_len) {
+			ctx->keys_pos = 0;
+			ctx->repeat--;
+		}
+	}
+	if (n < len && !ctx->repeat && !ctx->entered) {
+		buf[n++] = '\r';
+		ctx->entered = true;
+	}
+	return n ? (int)n : -1;
+}
+
+static void bench_write(void *context, const char *buf, size_t len)
+{
+	struct bench_context *ctx = context;
+
+	ctx->output += len;
+	sink += buf[len - 1];
+}
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void read_keys(struct bench_context *ctx, const char *keys,
+		      unsigned long repeat)
+{
+	ctx->keys = keys;
+	ctx->keys_len = strlen(keys);
+	ctx->keys_pos = 0;
+	ctx->repeat = repeat;
+	ctx->entered = false;
+	tinyrl_readline_ref(ctx->tinyrl, "> ", NULL);
+}
+
+/* time a run of the benchmark, excluding everything else */
+static void timed_run(struct bench_context *ctx)
+{
+	unsigned long allocs = ctx->allocs;
+	size_t output = ctx->output;
+	uint64_t start = now();
+
+	current->run(ctx, ctx->iterations);
+	ctx->elapsed = now() - start;
+	ctx->run_allocs = ctx->allocs - allocs;
+	ctx->run_output = ctx->output - output;
+}
+
+static bool run_key(void *context, char *key)
+{
+	timed_run(context);
+	return true;
+}
+
+/* replace the line with one of arg bytes */
+static bool fill_key(void *context, char *key)
+{
+	static const char words[] = "show interface ethernet0 counters ";
+	struct bench_context *ctx = context;
+	struct tinyrl *t = ctx->tinyrl;
+	size_t i, n;
+
+	tinyrl_delete_text(t, 0, strlen(tinyrl_get_line(t)));
+	for (i = 0; i < current->arg; i += n) {
+		n = current->arg - i;
+		if (n > sizeof(words) - 1)
+			n = sizeof(words) - 1;
+		tinyrl_insert_text_len(t, words, n);
+	}
+	return true;
+}
+
+static void bench_insert_delete(struct bench_context *ctx,
+				unsigned long iterations)
+{
+	struct tinyrl *t = ctx->tinyrl;
+	unsigned point;
+	unsigned long i;
+
+	point = tinyrl_get_point(t);
+	for (i = 0; i < iterations; i++) {
+		tinyrl_insert_text_len(t, "x", 1);
+		tinyrl_delete_text(t, point, point + 1);
+	}
+}
+
+static void bench_redisplay(struct bench_context *ctx,
+			    unsigned long iterations)
+{
+	struct tinyrl *t = ctx->tinyrl;
+	unsigned point;
+	unsigned long i;
+
+	point = tinyrl_get_point(t);
+	for (i = 0; i < iterations; i++) {
+		tinyrl_insert_text_len(t, "x", 1);
+		tinyrl_redisplay(t);
+		tinyrl_delete_text(t, point, point + 1);
+		tinyrl_redisplay(t);
+	}
+}
+
+/* every word in its own style */
+static size_t highlight_words(void *context, const char *line, size_t len,
+			      size_t *start, size_t *end,
+			      struct tinyrl_span *spans, size_t max)
+{
+	size_t i = *start, word, n = 0;
+
+	while (i < *end) {
+		while (i < *end && line[i] == ' ')
+			i++;
+		for (word = i; i < *end && line[i] != ' '; i++)
+			;
+		if (word == i)
+			break;
+		if (n < max) {
+			spans[n].start = word;
+			spans[n].end = i;
+			spans[n].style = 1 + word % 3;
+		}
+		n++;
+	}
+	return n;
+}
+
+static void bench_redisplay_highlight(struct bench_context *ctx,
+				      unsigned long iterations)
+{
+	tinyrl_set_style(ctx->tinyrl, 1, "1");
+	tinyrl_set_style(ctx->tinyrl, 2, "32");
+	tinyrl_set_style(ctx->tinyrl, 3, "33");
+	tinyrl_set_highlight(ctx->tinyrl, highlight_words, NULL);
+	bench_redisplay(ctx, iterations);
+}
+
+static void bench_complete(struct bench_context *ctx,
+			   unsigned long iterations)
+{
+	struct tinyrl *t = ctx->tinyrl;
+	char **matches;
+	char match[32];
+	unsigned long i, j;
+
+	for (i = 0; i < iterations; i++) {
+		tinyrl_delete_text(t, 0, strlen(tinyrl_get_line(t)));
+		matches = NULL;
+		for (j = 0; j < current->arg; j++) {
+			snprintf(match, sizeof(match), "command%lu", j);
+			matches = tinyrl_add_match(t, 0, matches, match);
+		}
+		tinyrl_complete(t, 0, matches, false);
+		tinyrl_delete_matches(matches);
+	}
+}
+
+/* arg matches, and a model of 1000 words used from them */
+static void setup_rank(struct bench_context *ctx)
+{
+	struct tinyrl_usage *usage;
+	char **matches = NULL;
+	char line[32];
+	unsigned long i;
+
+	usage = tinyrl_usage_new(ctx->tinyrl, 1024, 100);
+	srand(1);
+	for (i = 0; i < 1000; i++) {
+		snprintf(line, sizeof(line), "command%d",
+			 rand() % (int)current->arg);
+		tinyrl_usage_add_line(usage, line);
+	}
+	for (i = 0; i < current->arg; i++) {
+		snprintf(line, sizeof(line), "command%lu", i);
+		matches = tinyrl_add_match(ctx->tinyrl, 0, matches, line);
+	}
+	ctx->data = matches;
+}
+
+static void teardown_rank(struct bench_context *ctx)
+{
+	tinyrl_delete_matches(ctx->data);
+	tinyrl_usage_delete(tinyrl_get_usage(ctx->tinyrl));
+}
+
+/* put the most used of the matches first */
+static void bench_rank(struct bench_context *ctx, unsigned long iterations)
+{
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		sink += tinyrl_rank_matches(ctx->tinyrl, ctx->data, 32);
+}
+
+static bool noop_key(void *context, char *key)
+{
+	return true;
+}
+
+static void bench_keys(struct bench_context *ctx, unsigned long iterations)
+{
+	static const char *const keys[] = {
+		"a\x7f",		/* type and erase a character */
+		"\x1b[C",		/* an escape sequence */
+		"\x1c",			/* a bound key which does nothing */
+	};
+
+	tinyrl_bind_special(ctx->tinyrl, TINYRL_KEY_RIGHT, noop_key, NULL);
+	tinyrl_bind_key(ctx->tinyrl, '\x1c', noop_key, NULL);
+	read_keys(ctx, keys[current->arg], iterations);
+}
+
+static void bench_history_add(struct bench_context *ctx,
+			      unsigned long iterations)
+{
+	struct tinyrl_history *history;
+	unsigned long i;
+
+	history = tinyrl_history_new(ctx->tinyrl, current->arg);
+	for (i = 0; i < current->arg; i++)
+		tinyrl_history_add(history, "show interface ethernet0");
+	for (i = 0; i < iterations; i++)
+		tinyrl_history_add(history, "show interface ethernet0");
+	tinyrl_history_delete(history);
+}
+
+/* recall a long history entry and go back to the empty line */
+static void bench_history_recall(struct bench_context *ctx,
+				 unsigned long iterations)
+{
+	static const char words[] = "show interface ethernet0 counters ";
+	struct tinyrl_history *history;
+	char *entry;
+	size_t i;
+
+	entry = malloc(current->arg + 1);
+	if (!entry)
+		abort();
+	for (i = 0; i < current->arg; i++)
+		entry[i] = words[i % (sizeof(words) - 1)];
+	entry[i] = '\0';
+	history = tinyrl_history_new(ctx->tinyrl, 10);
+	tinyrl_history_add(history, entry);
+	read_keys(ctx, "\x1b[A\x1b[B", iterations);
+	tinyrl_history_delete(history);
+	free(entry);
+}
+
+/* a history of arg entries to suggest from */
+static void setup_history_suggest(struct bench_context *ctx)
+{
+	struct tinyrl_history *history;
+	char entry[64];
+	unsigned long i;
+
+	history = tinyrl_history_new(ctx->tinyrl, current->arg);
+	tinyrl_history_suggest_enable(history, true);
+	for (i = 0; i < current->arg; i++) {
+		snprintf(entry, sizeof(entry),
+			 "show interface ethernet%lu counters", i);
+		tinyrl_history_add(history, entry);
+	}
+	ctx->data = history;
+}
+
+static void teardown_history_suggest(struct bench_context *ctx)
+{
+	tinyrl_history_delete(ctx->data);
+}
+
+static void bench_history_suggest(struct bench_context *ctx,
+				  unsigned long iterations)
+{
+	static const char *const prefixes[] = {
+		"show", "show interface ethernet1", "show interface ethernet9999",
+		"no such",
+	};
+	struct tinyrl_history *history = ctx->data;
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		const char *prefix = prefixes[i % 4];
+
+		sink += (size_t)tinyrl_history_suggest(history, prefix,
+						       strlen(prefix));
+	}
+}
+
+/* start a session, draw its prompt and end it, with or without a pool */
+static void bench_session(struct bench_context *ctx, unsigned long iterations)
+{
+	struct tinyrl_allocator alloc = {
+		count_malloc, count_realloc, count_free, ctx
+	};
+	struct tinyrl *tinyrl = ctx->tinyrl;
+	struct tinyrl_pool *pool = NULL;
+	unsigned long i;
+
+	if (current->arg)
+		pool = tinyrl_pool_new(&alloc, 1);
+	for (i = 0; i < iterations; i++) {
+		if (pool)
+			ctx->tinyrl = tinyrl_pool_get(pool, bench_read,
+						      bench_write, ctx);
+		else
+			ctx->tinyrl = tinyrl_new_alloc(&alloc, bench_read,
+						       bench_write, ctx);
+		tinyrl_set_width(ctx->tinyrl, 80);
+		tinyrl_line_begin(ctx->tinyrl, "> ");
+		if (pool)
+			tinyrl_pool_put(pool, ctx->tinyrl);
+		else
+			tinyrl_delete(ctx->tinyrl);
+	}
+	if (pool)
+		tinyrl_pool_delete(pool);
+	ctx->tinyrl = tinyrl;
+}
+
+/* Latin, CJK and a combining sequence */
+static const char utf8_text[] =
+	"show interface \xe4\xb8\xad\xe6\x96\x87 e\xcc\x81t\xc3\xa9 counters";
+
+static void bench_utf8_grapheme(struct bench_context *ctx,
+				unsigned long iterations)
+{
+	size_t len = sizeof(utf8_text) - 1;
+	size_t point, width;
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		width = 0;
+		for (point = 0; point < len; )
+			width += utf8_grapheme_width(utf8_text, len, point,
+						     &point);
+		sink += width;
+	}
+}
+
+static void bench_utf8_char(struct bench_context *ctx,
+			    unsigned long iterations)
+{
+	size_t len = sizeof(utf8_text) - 1;
+	size_t point;
+	uint32_t c, sum;
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		sum = 0;
+		for (point = 0; point < len; ) {
+			point += utf8_char_decode(utf8_text + point,
+						  len - point, &c);
+			sum += c;
+		}
+		sink += sum;
+	}
+}
+
+/*
+ * In line keys: \x1e fills the line, ^A moves to its start, and \x1d
+ * runs the benchmark.
+ */
+static const struct bench benches[] = {
+	{ "insert_delete_short", bench_insert_delete, "\x1e\x01\x1d", true, 16 },
+	{ "insert_delete_huge", bench_insert_delete, "\x1e\x01\x1d", true, 1 << 20 },
+	{ "redisplay_short", bench_redisplay, "\x1e\x1d", true, 16 },
+	{ "redisplay_wrapped_end", bench_redisplay, "\x1e\x1d", true, 4096 },
+	{ "redisplay_wrapped_start", bench_redisplay, "\x1e\x01\x1d", true, 4096 },
+	{ "redisplay_highlight_short", bench_redisplay_highlight, "\x1e\x1d", true, 16 },
+	{ "redisplay_highlight_wrapped", bench_redisplay_highlight, "\x1e\x01\x1d", true, 4096 },
+	{ "keys_insert_erase", bench_keys, NULL, true, 0 },
+	{ "keys_escape_sequence", bench_keys, NULL, true, 1 },
+	{ "keys_bound", bench_keys, NULL, true, 2 },
+	{ "history_add_at_limit", bench_history_add, NULL, false, 1000 },
+	{ "history_recall_4k", bench_history_recall, NULL, false, 4096 },
+	{ "history_suggest_100k", bench_history_suggest, NULL, true, 100000,
+	  setup_history_suggest, teardown_history_suggest },
+	{ "session_new", bench_session, NULL, false, 0 },
+	{ "session_pool", bench_session, NULL, false, 1 },
+	{ "complete_10", bench_complete, "\x1d", false, 10 },
+	{ "complete_1k", bench_complete, "\x1d", false, 1000 },
+	{ "complete_100k", bench_complete, "\x1d", false, 100000 },
+	{ "rank_100k", bench_rank, NULL, false, 100000,
+	  setup_rank, teardown_rank },
+	{ "utf8_grapheme_width", bench_utf8_grapheme, NULL, true, 0 },
+	{ "utf8_char_decode", bench_utf8_char, NULL, true, 0 },
+};
+
+/* run a benchmark on a fresh instance, returning the elapsed time */
+static uint64_t run(struct bench_context *ctx, unsigned long iterations,
+		    unsigned long *allocs)
+{
+	struct tinyrl_allocator alloc = {
+		count_malloc, count_realloc, count_free, ctx
+	};
+	unsigned pass;
+
+	ctx->allocs = 0;
+	ctx->output = 0;
+	ctx->tinyrl = tinyrl_new_alloc(&alloc, bench_read, bench_write, ctx);
+	tinyrl_set_width(ctx->tinyrl, 80);
+	tinyrl_bind_key(ctx->tinyrl, '\x1d', run_key, ctx);
+	tinyrl_bind_key(ctx->tinyrl, '\x1e', fill_key, ctx);
+	if (current->setup)
+		current->setup(ctx);
+
+	/* one iteration first, so that the buffers have grown */
+	for (pass = 0; pass < 2; pass++) {
+		ctx->iterations = pass ? iterations : 1;
+		if (current->keys)
+			read_keys(ctx, current->keys, 1);
+		else
+			timed_run(ctx);
+	}
+	*allocs = ctx->run_allocs;
+
+	if (current->teardown)
+		current->teardown(ctx);
+	tinyrl_delete(ctx->tinyrl);
+	return ctx->elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_context ctx;
+	uint64_t min_time = 200000000, elapsed;
+	unsigned long iterations, allocs;
+	bool failed = false;
+	size_t i;
+	int arg, j;
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+			min_time = strtoull(argv[++arg], NULL, 10) * 1000000;
+		} else {
+			fprintf(stderr,
+				"usage: %s [-t milliseconds] [name...]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+		current = &benches[i];
+		if (arg < argc) {
+			for (j = arg; j < argc; j++)
+				if (strstr(current->name, argv[j]))
+					break;
+			if (j == argc)
+				continue;
+		}
+
+		/* double the iterations until the run is long enough */
+		iterations = 1;
+		for (;;) {
+			elapsed = run(&ctx, iterations, &allocs);
+			if (elapsed >= min_time || iterations >= 1UL << 30)
+				break;
+			iterations *= 2;
+		}
+
+		printf("{\"name\": \"%s\", \"iterations\": %lu, "
+		       "\"ns_per_op\": %.2f, \"allocs_per_op\": %.3f, "
+		       "\"bytes_out_per_op\": %.1f}\n",
+		       current->name, iterations, (double)elapsed / iterations,
+		       (double)allocs / iterations,
+		       (double)ctx.run_output / iterations);
+		fflush(stdout);
+
+		if (current->no_alloc && allocs) {
+			fprintf(stderr, "%s: %lu allocations in steady state\n",
+				current->name, allocs);
+			failed = true;
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -2,42 +2,193 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include "tinyrl.h"
+#include "usage.h"
+
+/* the most used matches, which are listed first */
+#define RANKED_MATCHES 32
+
+/*
+ * The match list handed to the client is the match array of this header,
+ * so that it can be extended without counting the entries each time, and
+ * freed using the allocator of the instance it was created for.
+ */
+struct tinyrl_matches {
+	const struct tinyrl *tinyrl;
+	size_t len;
+	size_t size;
+	char *match[];
+};
+
+static struct tinyrl_matches *matches_header(char **matches)
+{
+	return (struct tinyrl_matches *)
+		((char *)matches - offsetof(struct tinyrl_matches, match));
+}
 
 char **tinyrl_add_match(const struct tinyrl *this, unsigned start,
 			char **matches, const char *match)
 {
+	struct tinyrl_matches *header;
 	const char *line;
 	unsigned end;
-	size_t len;
-	char **m;
+	char *entry;
 
 	line = tinyrl_get_line(this);
 	end = tinyrl_get_point(this);
 	if (strncmp(match, line + start, end - start) != 0)
 		return matches;
 
-	len = 0;
-	if (matches)
-		for (m = matches; *m; m++)
-			len++;
-
-	/* Allocate memory for new match, plus terminator */
-	matches = realloc(matches, (len + 2) * sizeof(*matches));
-	matches[len] = strdup(match);
-	matches[len+1] = NULL;
-	return matches;
+	if (matches) {
+		header = matches_header(matches);
+	} else {
+		header = tinyrl__malloc(this, sizeof(*header)
+					+ 8 * sizeof(*header->match));
+		if (!header)
+			return NULL;
+		header->tinyrl = this;
+		header->len = 0;
+		header->size = 8;
+		header->match[0] = NULL;
+	}
+
+	/* Make room for new match, plus terminator */
+	if (header->len + 2 > header->size) {
+		struct tinyrl_matches *new_header;
+		size_t new_size = header->size * 2;
+
+		new_header = tinyrl__realloc(this, header, sizeof(*header)
+					     + new_size * sizeof(*header->match));
+		if (!new_header)
+			return header->match;
+		header = new_header;
+		header->size = new_size;
+	}
+
+	entry = tinyrl__strdup(this, match);
+	if (entry) {
+		header->match[header->len++] = entry;
+		header->match[header->len] = NULL;
+	}
+	return header->match;
 }
 
+/* matches must have been created by tinyrl_add_match() */
 void tinyrl_delete_matches(char **matches)
 {
+	struct tinyrl_matches *header = matches_header(matches);
 	char **m;
 
 	for (m = matches; *m; m++)
-		free(*m);
-	free(matches);
+		tinyrl__free(header->tinyrl, *m);
+	tinyrl__free(header->tinyrl, header);
+}
+
+/* a match chosen for ranking, where the worst is at the top of the heap */
+struct ranked {
+	uint32_t score;
+	size_t index;
+	char *match;
+};
+
+static bool ranked_worse(const struct ranked *a, const struct ranked *b)
+{
+	/* the provider's order breaks ties */
+	return a->score < b->score
+		|| (a->score == b->score && a->index > b->index);
+}
+
+static void ranked_sift_down(struct ranked *heap, size_t len, size_t i)
+{
+	struct ranked tmp;
+	size_t child;
+
+	for (; (child = 2 * i + 1) < len; i = child) {
+		if (child + 1 < len
+		    && ranked_worse(&heap[child + 1], &heap[child]))
+			child++;
+		if (!ranked_worse(&heap[child], &heap[i]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+	}
+}
+
+static void ranked_sift_up(struct ranked *heap, size_t i)
+{
+	struct ranked tmp;
+	size_t parent;
+
+	for (; i; i = parent) {
+		parent = (i - 1) / 2;
+		if (!ranked_worse(&heap[i], &heap[parent]))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = tmp;
+	}
+}
+
+size_t tinyrl_rank_matches(const struct tinyrl *this, char **matches,
+			   size_t k)
+{
+	struct tinyrl_usage *usage = tinyrl_get_usage(this);
+	struct ranked *heap, tmp;
+	size_t n, len, i, j;
+	uint32_t score;
+
+	if (!usage || !k || !matches)
+		return 0;
+	for (n = 0; matches[n]; n++)
+		;
+	if (k > n)
+		k = n;
+	heap = tinyrl__malloc(this, k * sizeof(*heap));
+	if (!heap)
+		return 0;
+
+	/* keep the k best in a heap, so that only they are ever sorted */
+	len = 0;
+	for (i = 0; i < n; i++) {
+		score = tinyrl_usage_score(usage, matches[i],
+					   strlen(matches[i]));
+		if (!score)
+			continue;
+		tmp.score = score;
+		tmp.index = i;
+		tmp.match = matches[i];
+		if (len < k) {
+			heap[len] = tmp;
+			ranked_sift_up(heap, len++);
+		} else if (ranked_worse(&heap[0], &tmp)) {
+			heap[0] = tmp;
+			ranked_sift_down(heap, len, 0);
+		}
+	}
+
+	/* best first, by taking the worst to the end */
+	for (j = len; j > 1; j--) {
+		tmp = heap[0];
+		heap[0] = heap[j - 1];
+		heap[j - 1] = tmp;
+		ranked_sift_down(heap, j - 1, 0);
+	}
+
+	/* move the others up behind them, in their order */
+	for (j = 0; j < len; j++)
+		matches[heap[j].index] = NULL;
+	for (i = n, j = n; i-- > 0; )
+		if (matches[i])
+			matches[--j] = matches[i];
+	for (j = 0; j < len; j++)
+		matches[j] = heap[j].match;
+
+	tinyrl__free(this, heap);
+	return len;
 }
 
 /* 
@@ -121,6 +272,7 @@ bool tinyrl_complete(struct tinyrl *this, unsigned start,
 
 	/* display matches if no progress was made */
 	if (!completion) {
+		tinyrl_rank_matches(this, matches, RANKED_MATCHES);
 		tinyrl_crlf(this);
 		tinyrl_display_matches(this, matches);
 		tinyrl_reset_line_state(this);
@@ -2,14 +2,31 @@
 #define _tinyrl_complete_h
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct tinyrl;
 
+/**
+ * Add match to the NULL terminated list of matches if it completes the
+ * text between start and the insertion point.  Start with a NULL list.
+ * The list remains bound to the instance's allocator, so it must be
+ * freed with tinyrl_delete_matches() before the instance is deleted.
+ */
 char **tinyrl_add_match(const struct tinyrl *this, unsigned start,
 			char **matches, const char *match);
 void tinyrl_delete_matches(char **matches);
 void tinyrl_display_matches(struct tinyrl * this, char *const *matches);
 
+/**
+ * Move the k matches which the instance's usage model scores highest to the
+ * front of the list, highest first, leaving the rest in their order.  Only
+ * matches which have been used are moved, and the result is how many
+ * were.  The list is never sorted as a whole, so this is cheap for long
+ * lists.  tinyrl_complete() does this before it displays the matches.
+ */
+size_t tinyrl_rank_matches(const struct tinyrl *this, char **matches,
+			   size_t k);
+
 /**
  * Complete the current word in the input buffer.
  *
@@ -80,6 +80,7 @@ int main(int argc, char *argv[])
 	tinyrl_bind_key(t, ' ', space_key, t);
 
 	history = tinyrl_history_new(t, 0);
+	tinyrl_begin_session(t);
 
 	for (;;) {
 		line = tinyrl_readline(t, "> ");
@@ -97,6 +98,7 @@ int main(int argc, char *argv[])
 		free(line);
 	}
 
+	tinyrl_end_session(t);
 	tinyrl_history_delete(history);
 	tinyrl_delete(t);
 	return 0;
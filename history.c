@@ -11,16 +11,60 @@
 
 #include "tinyrl.h"
 #include "history.h"
+#include "usage.h"
+
+/* an entry, measured once as it is added */
+struct tinyrl_history_entry {
+	char *line;
+	struct tinyrl_line_layout layout;
+};
+
+/*
+ * A node of the prefix index, a radix tree of the entries' text which
+ * finds the newest entry starting with a prefix in the prefix's length.
+ * Each node knows the newest entry below it, which stays right when the
+ * oldest entry is removed: a node whose newest that was held nothing else,
+ * so goes too.
+ */
+struct index_node {
+	struct index_node *child;	/* the first child */
+	struct index_node *next;	/* the next sibling */
+	const char *newest;	/* the text of the newest entry below */
+	unsigned long seq;	/* when that was added */
+	unsigned count;		/* entries below */
+	unsigned len;
+	char label[];
+};
 
 struct tinyrl_history {
 	struct tinyrl *tinyrl;
-	char **entries;	/* pointer entries */
+	struct tinyrl_history_entry *entries;
 	unsigned length;	/* Number of elements within this array */
 	unsigned size;		/* Number of slots allocated in this array */
 	unsigned limit;
 	unsigned iter;
+	size_t entry_bytes;	/* Total size of the entries themselves */
+	struct index_node *index;	/* NULL unless suggesting */
+	size_t index_bytes;
+	unsigned long seq;	/* entries ever added */
+	unsigned long allocs;
+	unsigned long frees;
 };
 
+/* recall an entry, or the line being edited past the newest */
+static void recall(struct tinyrl_history *history)
+{
+	const struct tinyrl_history_entry *entry;
+
+	if (history->iter < history->length) {
+		entry = &history->entries[history->iter];
+		tinyrl_set_line_layout(history->tinyrl, entry->line,
+				       &entry->layout);
+	} else {
+		tinyrl_set_line(history->tinyrl, NULL);
+	}
+}
+
 static bool tinyrl_history_key_up(void *context, char *key)
 {
 	struct tinyrl_history *history = context;
@@ -30,7 +74,7 @@ static bool tinyrl_history_key_up(void *context, char *key)
 	if (history->iter == 0)
 		return false;
 	history->iter--;
-	tinyrl_set_line(history->tinyrl, tinyrl_history_get(history, history->iter));
+	recall(history);
 	return true;
 }
 
@@ -41,7 +85,7 @@ static bool tinyrl_history_key_down(void *context, char *key)
 	if (tinyrl_history_get(history, history->iter) != tinyrl_get_line(history->tinyrl))
 		return false;
 	history->iter++;
-	tinyrl_set_line(history->tinyrl, tinyrl_history_get(history, history->iter));
+	recall(history);
 	return true;
 }
 
@@ -49,7 +93,7 @@ struct tinyrl_history *tinyrl_history_new(struct tinyrl *tinyrl, unsigned limit)
 {
 	struct tinyrl_history *history;
        
-	history = malloc(sizeof(*history));
+	history = tinyrl__malloc(tinyrl, sizeof(*history));
 	if (!history)
 		return NULL;
 
@@ -59,6 +103,12 @@ struct tinyrl_history *tinyrl_history_new(struct tinyrl *tinyrl, unsigned limit)
 	history->length = 0;
 	history->size = 0;
 	history->iter = 0;
+	history->entry_bytes = 0;
+	history->index = NULL;
+	history->index_bytes = 0;
+	history->seq = 0;
+	history->allocs = 1;
+	history->frees = 0;
 
 	tinyrl_bind_special(tinyrl, TINYRL_KEY_UP, tinyrl_history_key_up, history);
 	tinyrl_bind_special(tinyrl, TINYRL_KEY_DOWN, tinyrl_history_key_down, history);
@@ -69,10 +119,210 @@ void tinyrl_history_delete(struct tinyrl_history *history)
 {
 	unsigned i;
 
+	if (history->index)
+		tinyrl_history_suggest_enable(history, false);
+	tinyrl_unbind_special(history->tinyrl, TINYRL_KEY_UP,
+			      tinyrl_history_key_up, history);
+	tinyrl_unbind_special(history->tinyrl, TINYRL_KEY_DOWN,
+			      tinyrl_history_key_down, history);
 	for (i = 0; i < history->length; i++)
-		free(history->entries[i]);
-	free(history->entries);
-	free(history);
+		tinyrl__free(history->tinyrl, history->entries[i].line);
+	tinyrl__free(history->tinyrl, history->entries);
+	tinyrl__free(history->tinyrl, history);
+}
+
+static struct index_node *
+index_node_new(struct tinyrl_history *history, const char *label, size_t len)
+{
+	struct index_node *node;
+
+	node = tinyrl__malloc(history->tinyrl, sizeof(*node) + len);
+	if (!node)
+		return NULL;
+	history->allocs++;
+	history->index_bytes += sizeof(*node) + len;
+	node->child = NULL;
+	node->next = NULL;
+	node->newest = NULL;
+	node->seq = 0;
+	node->count = 0;
+	node->len = len;
+	memcpy(node->label, label, len);
+	return node;
+}
+
+static void index_node_free(struct tinyrl_history *history,
+			    struct index_node *node)
+{
+	struct index_node *next;
+
+	for (; node; node = next) {
+		next = node->next;
+		index_node_free(history, node->child);
+		history->index_bytes -= sizeof(*node) + node->len;
+		tinyrl__free(history->tinyrl, node);
+		history->frees++;
+	}
+}
+
+/* the child of node whose label starts with c, and the link to it */
+static struct index_node **index_child(struct index_node *node, char c)
+{
+	struct index_node **link;
+
+	for (link = &node->child; *link; link = &(*link)->next)
+		if ((*link)->label[0] == c)
+			break;
+	return link;
+}
+
+static size_t common_prefix(const char *a, const char *b, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len && a[i] == b[i]; i++)
+		;
+	return i;
+}
+
+/* add the newest entry to the index, which is false if memory ran out */
+static bool index_add(struct tinyrl_history *history, const char *line,
+		      size_t len)
+{
+	struct index_node *node = history->index, **link, *child, *split;
+	unsigned long seq = history->seq;
+	size_t pos = 0, n;
+
+	node->count++;
+	node->newest = line;
+	node->seq = seq;
+	while (pos < len) {
+		link = index_child(node, line[pos]);
+		child = *link;
+		if (!child) {
+			child = index_node_new(history, line + pos, len - pos);
+			if (!child)
+				return false;
+			child->count = 1;
+			child->newest = line;
+			child->seq = seq;
+			*link = child;
+			return true;
+		}
+
+		n = child->len < len - pos ? child->len : len - pos;
+		n = common_prefix(child->label, line + pos, n);
+		if (n < child->len) {
+			/* the line leaves this label part way along */
+			split = index_node_new(history, child->label, n);
+			if (!split)
+				return false;
+			split->next = child->next;
+			split->count = child->count;
+			split->newest = child->newest;
+			split->seq = child->seq;
+			child->next = NULL;
+			child->len -= n;
+			memmove(child->label, child->label + n, child->len);
+			history->index_bytes -= n;
+			split->child = tinyrl__realloc(history->tinyrl, child,
+						       sizeof(*child) + child->len);
+			if (split->child)
+				history->allocs++;
+			else
+				split->child = child;	/* still the old size */
+			*link = split;
+			child = split;
+		}
+		child->count++;
+		child->newest = line;
+		child->seq = seq;
+		node = child;
+		pos += n;
+	}
+	return true;
+}
+
+/* take the oldest entry out of the index */
+static void index_remove_oldest(struct tinyrl_history *history,
+				const char *line, size_t len)
+{
+	struct index_node *node = history->index, **link, *child;
+	size_t pos = 0;
+
+	node->count--;
+	while (pos < len) {
+		link = index_child(node, line[pos]);
+		child = *link;
+		assert(child);
+		if (!--child->count) {
+			/* nothing else was below it */
+			*link = child->next;
+			child->next = NULL;
+			index_node_free(history, child);
+			return;
+		}
+		node = child;
+		pos += child->len;
+	}
+}
+
+const char *tinyrl_history_suggest(const struct tinyrl_history *history,
+				   const char *line, size_t len)
+{
+	const struct index_node *node = history->index, *child, *best;
+	size_t pos = 0, n;
+
+	if (!node || !len)
+		return NULL;
+	while (pos < len) {
+		child = *index_child((struct index_node *)node, line[pos]);
+		if (!child)
+			return NULL;
+		n = child->len < len - pos ? child->len : len - pos;
+		if (common_prefix(child->label, line + pos, n) != n)
+			return NULL;
+		if (n < child->len) {
+			/* everything below extends the line */
+			return child->newest + len;
+		}
+		node = child;
+		pos += n;
+	}
+
+	/* the newest of the entries which are longer than the line */
+	best = NULL;
+	for (child = node->child; child; child = child->next)
+		if (!best || child->seq > best->seq)
+			best = child;
+	return best ? best->newest + len : NULL;
+}
+
+static const char *history_suggest(void *context, const char *line,
+				   size_t len)
+{
+	return tinyrl_history_suggest(context, line, len);
+}
+
+/* index the entries from scratch, or drop the index if memory runs out */
+static void index_build(struct tinyrl_history *history)
+{
+	unsigned i;
+
+	if (history->index)
+		index_node_free(history, history->index);
+	history->index = index_node_new(history, "", 0);
+	for (i = 0; history->index && i < history->length; i++) {
+		history->seq++;
+		if (!index_add(history, history->entries[i].line,
+			       history->entries[i].layout.len)) {
+			index_node_free(history, history->index);
+			history->index = NULL;
+		}
+	}
+	tinyrl_set_suggest(history->tinyrl, NULL, NULL);
+	if (history->index)
+		tinyrl_set_suggest(history->tinyrl, history_suggest, history);
 }
 
 /*
@@ -87,11 +337,26 @@ remove_entries(struct tinyrl_history *history, unsigned start, unsigned delta)
 
 	assert(end <= history->length);
 
-	for (i = start; i < end; i++)
-		free(history->entries[i]);
+	for (i = start; i < end; i++) {
+		if (history->index && !start)
+			index_remove_oldest(history, history->entries[i].line,
+					    history->entries[i].layout.len);
+		history->entry_bytes -= history->entries[i].layout.len + 1;
+		tinyrl__free(history->tinyrl, history->entries[i].line);
+		history->frees++;
+	}
 	memmove(history->entries + start, history->entries + end,
 		sizeof(*history->entries) * (history->length - end));
 	history->length -= delta;
+
+	if (history->index) {
+		/* the newest below a node may have gone unless it was the oldest */
+		if (start)
+			index_build(history);
+		else
+			tinyrl_set_suggest(history->tinyrl, history_suggest,
+					   history);
+	}
 }
 
 /* 
@@ -100,9 +365,29 @@ remove_entries(struct tinyrl_history *history, unsigned start, unsigned delta)
    */
 static void append_entry(struct tinyrl_history *history, const char *line)
 {
+	struct tinyrl_history_entry *entry;
+	size_t len;
+
 	if (history->length < history->size) {
-		history->entries[history->length] = strdup(line);
-		history->length++;
+		entry = &history->entries[history->length];
+		len = strlen(line);
+		entry->line = tinyrl__malloc(history->tinyrl, len + 1);
+		history->allocs++;
+		if (entry->line) {
+			memcpy(entry->line, line, len + 1);
+			tinyrl_measure_line(line, len, &entry->layout);
+			history->length++;
+			history->entry_bytes += len + 1;
+			history->seq++;
+			if (history->index
+			    && !index_add(history, entry->line, len)) {
+				/* out of step now, so give up suggesting */
+				tinyrl_history_suggest_enable(history, false);
+			} else if (history->index) {
+				tinyrl_set_suggest(history->tinyrl,
+						   history_suggest, history);
+			}
+		}
 	}
 }
 
@@ -112,10 +397,11 @@ static void grow(struct tinyrl_history *history)
 	if (history->size == history->length) {
 		/* increment the history memory by 10 entries each time we grow */
 		unsigned new_size = history->size + 10;
-		char **new_entries;
+		struct tinyrl_history_entry *new_entries;
 
-		new_entries = realloc(history->entries,
-				      sizeof(*history->entries) * new_size);
+		new_entries = tinyrl__realloc(history->tinyrl, history->entries,
+					      sizeof(*history->entries) * new_size);
+		history->allocs++;
 		if (NULL != new_entries) {
 			history->size = new_size;
 			history->entries = new_entries;
@@ -125,6 +411,10 @@ static void grow(struct tinyrl_history *history)
 
 void tinyrl_history_add(struct tinyrl_history *history, const char *line)
 {
+	struct tinyrl_usage *usage = tinyrl_get_usage(history->tinyrl);
+
+	if (usage)
+		tinyrl_usage_add_line(usage, line);
 	if (history->length && (history->length == history->limit)) {
 		/* remove the oldest entry */
 		remove_entries(history, 0, 1);
@@ -155,6 +445,21 @@ void tinyrl_history_limit(struct tinyrl_history *history, unsigned limit)
 	history->limit = limit;
 }
 
+bool tinyrl_history_suggest_enable(struct tinyrl_history *history,
+				   bool enable)
+{
+	if (enable) {
+		index_build(history);
+		return history->index != NULL;
+	}
+	if (history->index) {
+		index_node_free(history, history->index);
+		history->index = NULL;
+	}
+	tinyrl_set_suggest(history->tinyrl, NULL, NULL);
+	return true;
+}
+
 /*
    INFORMATION ABOUT THE HISTORY LIST 
    */
@@ -162,7 +467,16 @@ const char *tinyrl_history_get(const struct tinyrl_history *history,
 			       unsigned position)
 {
 	if (position < history->length)
-		return history->entries[position];
+		return history->entries[position].line;
+	return NULL;
+}
+
+const struct tinyrl_line_layout *
+tinyrl_history_get_layout(const struct tinyrl_history *history,
+			  unsigned position)
+{
+	if (position < history->length)
+		return &history->entries[position].layout;
 	return NULL;
 }
 
@@ -170,3 +484,103 @@ size_t tinyrl_history_length(const struct tinyrl_history *history)
 {
 	return history->length;
 }
+
+size_t tinyrl_history_snapshot(const struct tinyrl_history *history,
+			       void *buf, size_t size)
+{
+	struct tinyrl_history_snapshot header = {
+		.magic = "TRLH",
+		.version = 1,
+	};
+	char *p = buf;
+	size_t len;
+	unsigned i;
+
+	header.count = history->length;
+	header.bytes = history->entry_bytes;
+	if (sizeof(header) + header.bytes > size)
+		return sizeof(header) + header.bytes;
+
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	for (i = 0; i < history->length; i++) {
+		len = history->entries[i].layout.len + 1;
+		memcpy(p, history->entries[i].line, len);
+		p += len;
+	}
+	return sizeof(header) + header.bytes;
+}
+
+bool tinyrl_history_restore(struct tinyrl_history *history,
+			    const void *buf, size_t len)
+{
+	struct tinyrl_history_snapshot header;
+	const char *p, *end;
+	struct tinyrl_history_entry *entries;
+	unsigned count, skip;
+	size_t n;
+
+	if (history->length)
+		tinyrl_history_clear(history);
+	history->iter = 0;
+	if (len < sizeof(header))
+		return false;
+	memcpy(&header, buf, sizeof(header));
+	if (memcmp(header.magic, "TRLH", 4) != 0 || header.version != 1
+	    || len - sizeof(header) < header.bytes)
+		return false;
+
+	/* check that the entries are all there before taking any */
+	p = (const char *)buf + sizeof(header);
+	end = p + header.bytes;
+	for (count = 0; p < end; count++) {
+		n = strnlen(p, end - p);
+		if (n == (size_t)(end - p))
+			return false;
+		p += n + 1;
+	}
+	if (count != header.count)
+		return false;
+
+	/* keep the newest, in an array allocated once */
+	skip = history->limit && count > history->limit
+		? count - history->limit : 0;
+	if (history->size < count - skip) {
+		entries = tinyrl__realloc(history->tinyrl, history->entries,
+					  sizeof(*entries) * (count - skip));
+		history->allocs++;
+		if (!entries)
+			return false;
+		history->entries = entries;
+		history->size = count - skip;
+	}
+	p = (const char *)buf + sizeof(header);
+	for (; p < end; p += n + 1) {
+		n = strlen(p);
+		if (skip) {
+			skip--;
+			continue;
+		}
+		count = history->length;
+		append_entry(history, p);
+		if (history->length == count) {
+			if (count)
+				tinyrl_history_clear(history);
+			return false;
+		}
+	}
+	return true;
+}
+
+void tinyrl_history_get_stats(const struct tinyrl_history *history,
+			      struct tinyrl_history_stats *stats)
+{
+	stats->entries = history->length;
+	stats->entry_bytes = history->entry_bytes;
+	stats->array_bytes = history->size * sizeof(*history->entries);
+	stats->index_bytes = history->index_bytes;
+	stats->total_bytes = sizeof(*history)
+		+ stats->entry_bytes + stats->array_bytes + stats->index_bytes;
+	stats->allocs = history->allocs;
+	stats->frees = history->frees;
+}
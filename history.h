@@ -10,12 +10,15 @@
 #define _tinyrl_history_h
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 /**************************************
  * tinyrl_history class interface
  ************************************** */
 
 struct tinyrl;
+struct tinyrl_line_layout;
 
 struct tinyrl_history *tinyrl_history_new(struct tinyrl *tinyrl, unsigned limit);
 
@@ -33,5 +36,74 @@ const char *tinyrl_history_get(const struct tinyrl_history *history,
 				      unsigned offset);
 size_t tinyrl_history_length(const struct tinyrl_history *history);
 
+/* the measurements of an entry, which are taken as it is added */
+const struct tinyrl_line_layout *
+tinyrl_history_get_layout(const struct tinyrl_history *history,
+			  unsigned offset);
+
+/*
+   SUGGESTIONS
+   */
+/**
+ * Suggest the rest of the newest entry which starts with the line being
+ * edited, as tinyrl_set_suggest() describes, or stop.  The entries are
+ * kept in a prefix index, so finding one takes time in proportion to the
+ * length of the line rather than the number of entries.  The result is
+ * false if there was not the memory for the index, which is also dropped
+ * if memory runs out later.
+ */
+bool tinyrl_history_suggest_enable(struct tinyrl_history *history,
+				   bool enable);
+
+/* the rest of the newest entry which is longer than line and starts with it */
+const char *tinyrl_history_suggest(const struct tinyrl_history *history,
+				   const char *line, size_t len);
+
+/*
+   SNAPSHOTS
+   */
+/**
+ * The header of a history snapshot, followed by the entries, oldest
+ * first, each with its terminator.  It is in host byte order.
+ */
+struct tinyrl_history_snapshot {
+	char magic[4];		/* "TRLH" */
+	uint16_t version;	/* 1 */
+	uint16_t reserved;
+	uint32_t count;		/* entries */
+	uint32_t bytes;		/* the size of the entries which follow */
+};
+
+/**
+ * Save the entries into buf.  The result is the size of the snapshot, and
+ * nothing is written if that is more than size.
+ */
+size_t tinyrl_history_snapshot(const struct tinyrl_history *history,
+			       void *buf, size_t size);
+
+/**
+ * Replace the entries with those of a snapshot, keeping only the newest
+ * if there are more than the history's limit.  The result is false, with
+ * the history left empty, if the snapshot is not valid or memory ran out.
+ */
+bool tinyrl_history_restore(struct tinyrl_history *history,
+			    const void *buf, size_t len);
+
+/*
+   MEMORY USAGE
+   */
+struct tinyrl_history_stats {
+	size_t entries;		/* number of entries */
+	size_t entry_bytes;	/* memory held by the entries */
+	size_t array_bytes;	/* memory held by the entry array */
+	size_t index_bytes;	/* memory held by the prefix index */
+	size_t total_bytes;	/* all of the above, plus the history itself */
+	unsigned long allocs;	/* allocations since creation */
+	unsigned long frees;
+};
+
+void tinyrl_history_get_stats(const struct tinyrl_history *history,
+			      struct tinyrl_history_stats *stats);
+
 #endif				/* _tinyrl_history_h */
 /** @} tinyrl_history */
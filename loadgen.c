@@ -0,0 +1,257 @@
+/*
+ * loadgen.c
+ *
+ * Load for tinyrl_server: many synthetic operators, each on their own
+ * connection, typing command lines a key at a time with a pause between
+ * keys, now and then correcting a typo with a backspace.  Each operator
+ * waits for the echo of a key before thinking about the next one.
+ *
+ * usage: tinyrl_loadgen [-p port] [-c connections] [-d seconds]
+ *                       [-t think ms]
+ *
+ * The result is one JSON line with the keys and lines per second and the
+ * latency percentiles from sending a key to the first byte of its echo.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+static const char *const lines[] = {
+	"show interface ethernet0 counters",
+	"set ip address 192.0.2.1/24",
+	"show running-config section router bgp",
+	"ping 198.51.100.7 repeat 5 size 1400",
+	"exit",
+};
+#define LINES (sizeof(lines) / sizeof(lines[0]))
+
+struct operator {
+	int fd;
+	const char *line;	/* being typed */
+	size_t pos;
+	bool typo;		/* a wrong key has been typed */
+	uint64_t sent;		/* when the key awaiting its echo was sent */
+	uint64_t next;		/* when to send the next key */
+};
+
+struct samples {
+	uint64_t *values;
+	size_t len;
+	size_t size;
+};
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_sample(struct samples *samples, uint64_t value)
+{
+	if (samples->len == samples->size) {
+		samples->size = samples->size ? samples->size * 2 : 4096;
+		samples->values = realloc(samples->values,
+					  samples->size * sizeof(uint64_t));
+		if (!samples->values)
+			abort();
+	}
+	samples->values[samples->len++] = value;
+}
+
+static int compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(const struct samples *samples, double fraction)
+{
+	size_t i = fraction * samples->len;
+
+	if (!samples->len)
+		return 0;
+	if (i >= samples->len)
+		i = samples->len - 1;
+	return samples->values[i] / 1000.0;
+}
+
+static int connect_to(unsigned port)
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	int fd, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return fd;
+}
+
+/* the next key for an operator to type, returning true for Enter */
+static bool next_key(struct operator *op, char *key)
+{
+	if (op->typo) {
+		op->typo = false;
+		*key = '\x7f';
+		return false;
+	}
+	if (!op->line[op->pos]) {
+		*key = '\r';
+		op->line = lines[rand() % LINES];
+		op->pos = 0;
+		return true;
+	}
+	if (op->pos && rand() % 20 == 0) {
+		op->typo = true;
+		*key = 'q';
+		return false;
+	}
+	*key = op->line[op->pos++];
+	return false;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-p port] [-c connections] [-d seconds] "
+		"[-t think ms]\n", name);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned port = 7777, connections = 100, duration = 10, think = 100;
+	unsigned long keys = 0, enters = 0;
+	struct operator *ops;
+	struct pollfd *fds;
+	struct samples samples = { 0 };
+	uint64_t start, end, t, wake;
+	char buf[4096], key;
+	unsigned i;
+	int opt, n, timeout;
+
+	while ((opt = getopt(argc, argv, "p:c:d:t:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = strtoul(optarg, NULL, 10);
+			break;
+		case 'c':
+			connections = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			think = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!connections)
+		usage(argv[0]);
+
+	ops = calloc(connections, sizeof(*ops));
+	fds = calloc(connections, sizeof(*fds));
+	if (!ops || !fds)
+		return 1;
+
+	/* spread the operators over the think interval */
+	start = now();
+	for (i = 0; i < connections; i++) {
+		ops[i].fd = connect_to(port);
+		if (ops[i].fd < 0) {
+			perror("connect");
+			return 1;
+		}
+		ops[i].line = lines[i % LINES];
+		ops[i].next = start + (uint64_t)think * 1000000 * i / connections;
+		fds[i].fd = ops[i].fd;
+		fds[i].events = POLLIN;
+	}
+
+	start = now();
+	end = start + (uint64_t)duration * 1000000000;
+	while ((t = now()) < end) {
+		wake = end;
+		for (i = 0; i < connections; i++) {
+			struct operator *op = &ops[i];
+
+			if (op->sent)
+				continue;
+			if (op->next <= t) {
+				if (next_key(op, &key))
+					enters++;
+				if (send(op->fd, &key, 1, MSG_NOSIGNAL) != 1) {
+					perror("send");
+					return 1;
+				}
+				op->sent = now();
+				keys++;
+			} else if (op->next < wake) {
+				wake = op->next;
+			}
+		}
+
+		timeout = (wake - t) / 1000000;
+		n = poll(fds, connections, timeout);
+		if (n < 0 && errno != EINTR) {
+			perror("poll");
+			return 1;
+		}
+		t = now();
+		for (i = 0; n > 0 && i < connections; i++) {
+			struct operator *op = &ops[i];
+
+			if (!fds[i].revents)
+				continue;
+			n--;
+			if (recv(op->fd, buf, sizeof(buf), 0) <= 0) {
+				fprintf(stderr, "connection %u closed\n", i);
+				return 1;
+			}
+			if (op->sent) {
+				add_sample(&samples, t - op->sent);
+				op->sent = 0;
+				op->next = t + (uint64_t)think * 1000000;
+			}
+		}
+	}
+	t = now();
+
+	qsort(samples.values, samples.len, sizeof(uint64_t), compare);
+	printf("{\"connections\": %u, \"think_ms\": %u, \"seconds\": %.1f, "
+	       "\"keys_per_sec\": %.0f, \"lines_per_sec\": %.0f, "
+	       "\"echo_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+	       "\"p999\": %.1f, \"max\": %.1f}}\n",
+	       connections, think, (t - start) / 1e9,
+	       keys / ((t - start) / 1e9), enters / ((t - start) / 1e9),
+	       percentile(&samples, 0.5), percentile(&samples, 0.9),
+	       percentile(&samples, 0.99), percentile(&samples, 0.999),
+	       percentile(&samples, 1));
+
+	for (i = 0; i < connections; i++)
+		close(ops[i].fd);
+	free(samples.values);
+	free(fds);
+	free(ops);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * mempool.c
+ *
+ * A simple allocator over a caller supplied block of memory
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include "tinyrl.h"
+#include "mempool.h"
+
+/* Every chunk starts with this header, and free chunks are linked by it */
+struct chunk {
+	size_t size;		/* bytes in the chunk, including this header */
+	struct chunk *next;	/* next free chunk, in address order */
+};
+
+struct mempool {
+	struct chunk *free;
+};
+
+/* chunks are multiples of this, which also keeps payloads aligned */
+#define UNIT (2 * sizeof(void *))
+#define ROUND(n) (((n) + UNIT - 1) & ~(UNIT - 1))
+#define HEADER ROUND(sizeof(struct chunk))
+
+static void *payload(struct chunk *chunk)
+{
+	return (char *)chunk + HEADER;
+}
+
+static struct chunk *chunk_of(void *ptr)
+{
+	return (struct chunk *)((char *)ptr - HEADER);
+}
+
+/*
+ * Trim chunk to size bytes, returning any large enough remainder
+ * to the free list.
+ */
+static void split(struct mempool *pool, struct chunk *chunk, size_t size)
+{
+	struct chunk *rest;
+	struct chunk **link;
+
+	if (chunk->size < size + HEADER + UNIT)
+		return;
+
+	rest = (struct chunk *)((char *)chunk + size);
+	rest->size = chunk->size - size;
+	chunk->size = size;
+
+	for (link = &pool->free; *link && *link < rest; link = &(*link)->next)
+		;
+	rest->next = *link;
+	*link = rest;
+
+	/* the remainder may border on a free chunk */
+	if (rest->next && (char *)rest + rest->size == (char *)rest->next) {
+		rest->size += rest->next->size;
+		rest->next = rest->next->next;
+	}
+}
+
+static void *mempool_malloc(void *context, size_t size)
+{
+	struct mempool *pool = context;
+	struct chunk **link;
+	struct chunk *chunk;
+	size_t need = HEADER + ROUND(size ? size : 1);
+
+	for (link = &pool->free; *link; link = &(*link)->next) {
+		if ((*link)->size >= need) {
+			chunk = *link;
+			*link = chunk->next;
+			split(pool, chunk, need);
+			return payload(chunk);
+		}
+	}
+	return NULL;
+}
+
+static void mempool_free(void *context, void *ptr)
+{
+	struct mempool *pool = context;
+	struct chunk **link;
+	struct chunk *chunk, *prev;
+
+	if (!ptr)
+		return;
+	chunk = chunk_of(ptr);
+
+	prev = NULL;
+	for (link = &pool->free; *link && *link < chunk; link = &(*link)->next)
+		prev = *link;
+	chunk->next = *link;
+	*link = chunk;
+
+	/* merge with the following and preceding chunks if they are free */
+	if (chunk->next && (char *)chunk + chunk->size == (char *)chunk->next) {
+		chunk->size += chunk->next->size;
+		chunk->next = chunk->next->next;
+	}
+	if (prev && (char *)prev + prev->size == (char *)chunk) {
+		prev->size += chunk->size;
+		prev->next = chunk->next;
+	}
+}
+
+static void *mempool_realloc(void *context, void *ptr, size_t size)
+{
+	struct mempool *pool = context;
+	struct chunk **link;
+	struct chunk *chunk, *next;
+	size_t need = HEADER + ROUND(size ? size : 1);
+	void *new_ptr;
+
+	if (!ptr)
+		return mempool_malloc(context, size);
+	chunk = chunk_of(ptr);
+
+	/* grow in place into a free chunk which follows this one */
+	if (chunk->size < need) {
+		next = (struct chunk *)((char *)chunk + chunk->size);
+		for (link = &pool->free; *link && *link < next;
+		     link = &(*link)->next)
+			;
+		if (*link == next && chunk->size + next->size >= need) {
+			*link = next->next;
+			chunk->size += next->size;
+		}
+	}
+
+	if (chunk->size >= need) {
+		split(pool, chunk, need);
+		return ptr;
+	}
+
+	new_ptr = mempool_malloc(context, size);
+	if (new_ptr) {
+		memcpy(new_ptr, ptr, chunk->size - HEADER);
+		mempool_free(context, ptr);
+	}
+	return new_ptr;
+}
+
+bool tinyrl_mempool_init(struct tinyrl_allocator *alloc, void *mem, size_t size)
+{
+	uintptr_t start = (uintptr_t)mem;
+	uintptr_t end = start + size;
+	struct mempool *pool;
+	struct chunk *chunk;
+
+	/* the pool itself lives at the start of the block */
+	start = ROUND(start);
+	pool = (struct mempool *)start;
+	start = ROUND(start + sizeof(*pool));
+	end &= ~(uintptr_t)(UNIT - 1);
+	if (end < start + HEADER + UNIT)
+		return false;
+
+	chunk = (struct chunk *)start;
+	chunk->size = end - start;
+	chunk->next = NULL;
+	pool->free = chunk;
+
+	alloc->malloc = mempool_malloc;
+	alloc->realloc = mempool_realloc;
+	alloc->free = mempool_free;
+	alloc->context = pool;
+	return true;
+}
+
+size_t tinyrl_mempool_available(const struct tinyrl_allocator *alloc)
+{
+	const struct mempool *pool = alloc->context;
+	const struct chunk *chunk;
+	size_t size = 0;
+
+	for (chunk = pool->free; chunk; chunk = chunk->next)
+		size += chunk->size - HEADER;
+	return size;
+}
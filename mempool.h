@@ -0,0 +1,34 @@
+/**
+  \ingroup tinyrl
+  \defgroup tinyrl_mempool mempool
+  @{
+
+  \brief This provides allocator hooks which carve memory out of a single
+  caller supplied block, so that tinyrl can be used without a heap.
+
+*/
+#ifndef _tinyrl_mempool_h
+#define _tinyrl_mempool_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct tinyrl_allocator;
+
+/**
+ * Set up alloc to allocate from the size bytes at mem, which must remain
+ * valid for as long as anything allocated from it.
+ *
+ * Allocation is first-fit from an address ordered free list, with freed
+ * memory merged back into its neighbours.  The result is false if mem is
+ * too small to be used.
+ */
+bool tinyrl_mempool_init(struct tinyrl_allocator *alloc, void *mem, size_t size);
+
+/**
+ * Return the number of bytes in the pool that are currently free.
+ */
+size_t tinyrl_mempool_available(const struct tinyrl_allocator *alloc);
+
+#endif				/* _tinyrl_mempool_h */
+/** @} tinyrl_mempool */
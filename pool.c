@@ -0,0 +1,116 @@
+/*
+ * pool.c
+ *
+ * A pool of idle instances
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "tinyrl.h"
+#include "pool.h"
+
+struct tinyrl_pool {
+	struct tinyrl_allocator alloc;
+	bool has_alloc;
+	unsigned size;
+	unsigned idle;
+	unsigned long reused;
+	unsigned long created;
+	struct tinyrl *instances[];	/* the idle instances */
+};
+
+static int pool_no_read(void *context, char *buf, size_t len, bool block)
+{
+	return -1;
+}
+
+static void pool_no_write(void *context, const char *buf, size_t len)
+{
+}
+
+static struct tinyrl *pool_create(struct tinyrl_pool *pool,
+				  tinyrl_read_func_t *read,
+				  tinyrl_write_func_t *write, void *context)
+{
+	pool->created++;
+	return tinyrl_new_alloc(pool->has_alloc ? &pool->alloc : NULL,
+				read, write, context);
+}
+
+struct tinyrl_pool *tinyrl_pool_new(const struct tinyrl_allocator *alloc,
+				    unsigned size)
+{
+	struct tinyrl_pool *pool;
+	size_t bytes = sizeof(*pool) + size * sizeof(pool->instances[0]);
+
+	if (alloc) {
+		pool = alloc->malloc(alloc->context, bytes);
+	} else {
+#ifdef TINYRL_STATIC_MEMORY
+		return NULL;
+#else
+		pool = malloc(bytes);
+#endif
+	}
+	if (!pool)
+		return NULL;
+	memset(pool, 0, sizeof(*pool));
+	if (alloc) {
+		pool->alloc = *alloc;
+		pool->has_alloc = true;
+	}
+	pool->size = size;
+
+	/* the idle instances are reset when they are taken */
+	while (pool->idle < size) {
+		pool->instances[pool->idle] = pool_create(pool, pool_no_read,
+							  pool_no_write, NULL);
+		if (!pool->instances[pool->idle])
+			break;
+		pool->idle++;
+	}
+	return pool;
+}
+
+void tinyrl_pool_delete(struct tinyrl_pool *pool)
+{
+	while (pool->idle)
+		tinyrl_delete(pool->instances[--pool->idle]);
+	if (pool->has_alloc)
+		pool->alloc.free(pool->alloc.context, pool);
+#ifndef TINYRL_STATIC_MEMORY
+	else
+		free(pool);
+#endif
+}
+
+struct tinyrl *tinyrl_pool_get(struct tinyrl_pool *pool,
+			       tinyrl_read_func_t *read,
+			       tinyrl_write_func_t *write, void *context)
+{
+	struct tinyrl *tinyrl;
+
+	if (!pool->idle)
+		return pool_create(pool, read, write, context);
+	tinyrl = pool->instances[--pool->idle];
+	tinyrl_reset(tinyrl, read, write, context);
+	pool->reused++;
+	return tinyrl;
+}
+
+void tinyrl_pool_put(struct tinyrl_pool *pool, struct tinyrl *tinyrl)
+{
+	if (pool->idle == pool->size) {
+		tinyrl_delete(tinyrl);
+		return;
+	}
+	pool->instances[pool->idle++] = tinyrl;
+}
+
+void tinyrl_pool_get_stats(const struct tinyrl_pool *pool,
+			   struct tinyrl_pool_stats *stats)
+{
+	stats->idle = pool->idle;
+	stats->reused = pool->reused;
+	stats->created = pool->created;
+}
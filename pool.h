@@ -0,0 +1,58 @@
+/**
+  \ingroup tinyrl
+  \defgroup tinyrl_pool pool
+  @{
+
+  \brief This class keeps idle instances for reuse, for servers which
+  create and destroy sessions constantly.
+
+  An instance taken from a pool is reset as if newly created, but keeps
+  the buffers it has grown and the memory of its key bindings, so that
+  starting a session normally makes no allocations.
+
+*/
+#ifndef _tinyrl_pool_h
+#define _tinyrl_pool_h
+
+#include <stddef.h>
+
+#include "tinyrl.h"
+
+struct tinyrl_pool;
+
+/**
+ * Create a pool which keeps up to size idle instances, and create them
+ * now.  All memory, for the pool and its instances, is obtained from
+ * alloc, as for tinyrl_new_alloc().
+ */
+struct tinyrl_pool *tinyrl_pool_new(const struct tinyrl_allocator *alloc,
+				    unsigned size);
+
+/* delete the pool and its idle instances */
+void tinyrl_pool_delete(struct tinyrl_pool *pool);
+
+/**
+ * Take an idle instance, reset with tinyrl_reset(), or create one if there
+ * are none.
+ */
+struct tinyrl *tinyrl_pool_get(struct tinyrl_pool *pool,
+			       tinyrl_read_func_t *read,
+			       tinyrl_write_func_t *write, void *context);
+
+/**
+ * Return an instance which was taken from the pool.  It is deleted if the
+ * pool is full.  Delete anything made for it, such as its history, first.
+ */
+void tinyrl_pool_put(struct tinyrl_pool *pool, struct tinyrl *tinyrl);
+
+struct tinyrl_pool_stats {
+	unsigned idle;		/* instances in the pool */
+	unsigned long reused;	/* tinyrl_pool_get() calls which reused one */
+	unsigned long created;	/* instances created, including the first */
+};
+
+void tinyrl_pool_get_stats(const struct tinyrl_pool *pool,
+			   struct tinyrl_pool_stats *stats);
+
+#endif				/* _tinyrl_pool_h */
+/** @} tinyrl_pool */
@@ -0,0 +1,445 @@
+/*
+ * ptybench.c
+ *
+ * End to end keystroke latency, measured through a pseudo-terminal.  A
+ * child process runs an ordinary tinyrl session on the terminal, with
+ * history and completion, while the parent replays keystroke scripts into
+ * it and times the output which each keystroke produces.
+ *
+ * usage: tinyrl_ptybench [-r keys/second] [-n repeat] [scenario...]
+ *
+ * With no rate each key is sent once the output for the previous one has
+ * finished.  Results are printed one JSON object per line.
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "tinyrl.h"
+#include "history.h"
+#include "complete.h"
+
+/* output is finished once the terminal has been quiet for this long */
+#define QUIET_MS 2
+#define TIMEOUT_MS 1000
+
+static const char *const commands[] = {
+	"show", "set", "shutdown", "service", "session", "snmp", "ssh",
+	"interface", "ip", "ipv6", "exit", "help", "history", "hostname",
+};
+
+struct step {
+	const char *bytes;
+	size_t len;
+	bool measure;
+};
+
+struct script {
+	struct step *steps;
+	size_t len;
+	size_t size;
+};
+
+struct result {
+	uint64_t *first;	/* key sent to first output byte */
+	uint64_t *last;		/* key sent to last output byte */
+	size_t keys;
+	size_t bytes;
+};
+
+/*
+ * The child: a session like example.c, on the terminal.
+ */
+static bool complete_key(void *context, char *key)
+{
+	struct tinyrl *t = context;
+	const char *text;
+	unsigned start, end;
+	char **matches = NULL;
+	bool ret;
+	size_t i;
+
+	text = tinyrl_get_line(t);
+	start = end = tinyrl_get_point(t);
+	while (start && !isspace((unsigned char)text[start - 1]))
+		start--;
+	for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+		matches = tinyrl_add_match(t, start, matches, commands[i]);
+	if (!matches)
+		return false;
+	ret = tinyrl_complete(t, start, matches, false);
+	tinyrl_delete_matches(matches);
+	if (ret)
+		return tinyrl_insert_text(t, " ");
+	return false;
+}
+
+static int child(void)
+{
+	struct tinyrl_history *history;
+	struct tinyrl *t;
+	const char *line;
+
+	t = tinyrl_new(stdin, stdout);
+	tinyrl_bind_key(t, '\t', complete_key, t);
+	history = tinyrl_history_new(t, 0);
+	tinyrl_begin_session(t);
+	while ((line = tinyrl_readline_ref(t, "> ", NULL))) {
+		if (*line)
+			tinyrl_history_add(history, line);
+	}
+	tinyrl_end_session(t);
+	tinyrl_history_delete(history);
+	tinyrl_delete(t);
+	return 0;
+}
+
+/*
+ * The scripts.
+ */
+static const char *const lines[] = {
+	"show interface ethernet0 counters",
+	"set ip address 192.0.2.1/24",
+	"show running-config section router bgp",
+	"ping 198.51.100.7 repeat 5 size 1400",
+};
+#define LINES (sizeof(lines) / sizeof(lines[0]))
+
+static void add_step(struct script *script, const char *bytes, size_t len,
+		     bool measure)
+{
+	if (script->len == script->size) {
+		script->size = script->size ? script->size * 2 : 64;
+		script->steps = realloc(script->steps,
+					script->size * sizeof(*script->steps));
+		if (!script->steps)
+			abort();
+	}
+	script->steps[script->len].bytes = bytes;
+	script->steps[script->len].len = len;
+	script->steps[script->len].measure = measure;
+	script->len++;
+}
+
+/* type a line a key at a time */
+static void type_line(struct script *script, const char *line, bool measure)
+{
+	for (; *line; line++)
+		add_step(script, line, 1, measure);
+	add_step(script, "\r", 1, measure);
+}
+
+static void script_typing(struct script *script)
+{
+	size_t i;
+
+	for (i = 0; i < LINES; i++)
+		type_line(script, lines[i], true);
+}
+
+static void script_paste(struct script *script)
+{
+	size_t i;
+
+	/* each line arrives in one write, as a paste does */
+	for (i = 0; i < LINES; i++) {
+		add_step(script, lines[i], strlen(lines[i]), true);
+		add_step(script, "\r", 1, true);
+	}
+}
+
+static void script_history(struct script *script)
+{
+	size_t i;
+
+	for (i = 0; i < LINES; i++)
+		type_line(script, lines[i], false);
+	for (i = 0; i < LINES; i++)
+		add_step(script, "\x1b[A", 3, true);
+	for (i = 0; i < LINES; i++)
+		add_step(script, "\x1b[B", 3, true);
+	add_step(script, "\x15", 1, false);
+}
+
+static void script_completion(struct script *script)
+{
+	static const char *const words[] = { "sh", "i", "h", "e" };
+	size_t i;
+
+	for (i = 0; i < sizeof(words) / sizeof(words[0]); i++) {
+		add_step(script, words[i], strlen(words[i]), false);
+		add_step(script, "\t", 1, true);
+		add_step(script, "\x15", 1, false);
+	}
+}
+
+static const struct scenario {
+	const char *name;
+	void (*build)(struct script *script);
+} scenarios[] = {
+	{ "typing", script_typing },
+	{ "paste", script_paste },
+	{ "history", script_history },
+	{ "completion", script_completion },
+};
+
+/*
+ * The parent.
+ */
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int wait_readable(int fd, int timeout_ms)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	int n;
+
+	do {
+		n = poll(&pfd, 1, timeout_ms);
+	} while (n < 0 && errno == EINTR);
+	return n;
+}
+
+/* read whatever output is pending, returning its size */
+static size_t drain(int fd)
+{
+	char buf[4096];
+	ssize_t n;
+
+	n = read(fd, buf, sizeof(buf));
+	return n > 0 ? n : 0;
+}
+
+/* read until the terminal is quiet, returning the bytes read */
+static size_t drain_quiet(int fd, uint64_t *last)
+{
+	size_t bytes = 0, n;
+
+	while (wait_readable(fd, QUIET_MS) > 0) {
+		n = drain(fd);
+		if (!n)
+			break;
+		bytes += n;
+		if (last)
+			*last = now();
+	}
+	return bytes;
+}
+
+static void send_step(int fd, const struct step *step)
+{
+	if (write(fd, step->bytes, step->len) != (ssize_t)step->len) {
+		perror("write");
+		exit(1);
+	}
+}
+
+/* send each key once the output for the previous one has finished */
+static void run_closed(int fd, const struct script *script,
+		       struct result *result)
+{
+	uint64_t sent, last;
+	size_t i, bytes;
+
+	for (i = 0; i < script->len; i++) {
+		const struct step *step = &script->steps[i];
+
+		sent = now();
+		send_step(fd, step);
+		if (wait_readable(fd, TIMEOUT_MS) <= 0) {
+			fprintf(stderr, "no output for step %zu\n", i);
+			continue;
+		}
+		last = now();
+		if (step->measure)
+			result->first[result->keys] = last - sent;
+		bytes = drain(fd);
+		bytes += drain_quiet(fd, &last);
+		if (step->measure) {
+			result->last[result->keys] = last - sent;
+			result->bytes += bytes;
+			result->keys++;
+		}
+	}
+}
+
+/* send keys at a fixed rate, attributing output to the latest key */
+static void run_open(int fd, const struct script *script, unsigned rate,
+		     struct result *result)
+{
+	uint64_t interval = 1000000000 / rate;
+	uint64_t start = now(), sent = 0, t, next;
+	size_t i, key = 0, bytes;
+	bool pending = false, measure = false;
+	int timeout;
+
+	for (i = 0; i <= script->len; ) {
+		next = start + i * interval;
+		t = now();
+		if (t >= next) {
+			if (i == script->len)
+				break;
+			sent = now();
+			send_step(fd, &script->steps[i]);
+			measure = script->steps[i].measure;
+			if (measure) {
+				key = result->keys++;
+				result->first[key] = 0;
+				result->last[key] = 0;
+			}
+			pending = true;
+			i++;
+			continue;
+		}
+		timeout = (next - t + 999999) / 1000000;
+		if (wait_readable(fd, timeout) <= 0)
+			continue;
+		bytes = drain(fd);
+		t = now();
+		if (measure) {
+			if (pending)
+				result->first[key] = t - sent;
+			result->last[key] = t - sent;
+			result->bytes += bytes;
+		}
+		pending = false;
+	}
+	drain_quiet(fd, NULL);
+}
+
+static int compare(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(uint64_t *values, size_t len, double fraction)
+{
+	size_t i = fraction * len;
+
+	if (!len)
+		return 0;
+	if (i >= len)
+		i = len - 1;
+	return values[i] / 1000.0;
+}
+
+static void report(const char *name, unsigned rate, struct result *result)
+{
+	qsort(result->first, result->keys, sizeof(uint64_t), compare);
+	qsort(result->last, result->keys, sizeof(uint64_t), compare);
+	printf("{\"name\": \"%s\", \"rate\": %u, \"keys\": %zu, "
+	       "\"first_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+	       "\"max\": %.1f}, "
+	       "\"last_us\": {\"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+	       "\"max\": %.1f}, \"bytes_per_key\": %.1f}\n",
+	       name, rate, result->keys,
+	       percentile(result->first, result->keys, 0.5),
+	       percentile(result->first, result->keys, 0.9),
+	       percentile(result->first, result->keys, 0.99),
+	       percentile(result->first, result->keys, 1),
+	       percentile(result->last, result->keys, 0.5),
+	       percentile(result->last, result->keys, 0.9),
+	       percentile(result->last, result->keys, 0.99),
+	       percentile(result->last, result->keys, 1),
+	       result->keys ? (double)result->bytes / result->keys : 0);
+	fflush(stdout);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-r keys/second] [-n repeat] [scenario...]\n",
+		name);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	struct winsize ws = { .ws_row = 24, .ws_col = 80 };
+	struct script script;
+	struct result result;
+	unsigned rate = 0, repeat = 20;
+	size_t i, r;
+	int fd, opt, j, status;
+	pid_t pid;
+
+	while ((opt = getopt(argc, argv, "r:n:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			repeat = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	pid = forkpty(&fd, NULL, NULL, &ws);
+	if (pid < 0) {
+		perror("forkpty");
+		return 1;
+	}
+	if (pid == 0)
+		return child();
+
+	/* wait for the first prompt */
+	if (wait_readable(fd, TIMEOUT_MS) <= 0) {
+		fprintf(stderr, "no prompt\n");
+		return 1;
+	}
+	drain_quiet(fd, NULL);
+
+	for (i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+		if (optind < argc) {
+			for (j = optind; j < argc; j++)
+				if (strcmp(scenarios[i].name, argv[j]) == 0)
+					break;
+			if (j == argc)
+				continue;
+		}
+
+		memset(&script, 0, sizeof(script));
+		for (r = 0; r < repeat; r++)
+			scenarios[i].build(&script);
+
+		memset(&result, 0, sizeof(result));
+		result.first = calloc(script.len, sizeof(uint64_t));
+		result.last = calloc(script.len, sizeof(uint64_t));
+		if (!result.first || !result.last)
+			abort();
+		if (rate)
+			run_open(fd, &script, rate, &result);
+		else
+			run_closed(fd, &script, &result);
+		report(scenarios[i].name, rate, &result);
+
+		free(result.first);
+		free(result.last);
+		free(script.steps);
+	}
+
+	/* hanging up ends the session */
+	close(fd);
+	if (waitpid(pid, &status, WNOHANG) == 0) {
+		usleep(100000);
+		kill(pid, SIGTERM);
+		waitpid(pid, &status, 0);
+	}
+	return 0;
+}
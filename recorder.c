@@ -0,0 +1,234 @@
+/*
+ * recorder.c
+ *
+ * A flight recorder of editor events
+ */
+#include <ctype.h>
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tinyrl.h"
+#include "recorder.h"
+
+/*
+ * The instance is the only writer.  head counts every event ever added,
+ * and is published after the event's slot has been filled, so a reader
+ * can tell which slots are complete and which it may have raced with.
+ */
+struct tinyrl_recorder {
+	struct tinyrl *tinyrl;
+	uint64_t head;
+	size_t mask;
+	struct tinyrl_event events[];
+};
+
+static uint64_t recorder_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct tinyrl_recorder *tinyrl_recorder_new(struct tinyrl *tinyrl,
+					    size_t events)
+{
+	struct tinyrl_recorder *recorder;
+	size_t size = 1;
+
+	while (size < events)
+		size *= 2;
+	recorder = tinyrl__malloc(tinyrl, sizeof(*recorder)
+				  + size * sizeof(recorder->events[0]));
+	if (!recorder)
+		return NULL;
+	recorder->tinyrl = tinyrl;
+	recorder->head = 0;
+	recorder->mask = size - 1;
+	tinyrl_set_recorder(tinyrl, recorder);
+	return recorder;
+}
+
+void tinyrl_recorder_delete(struct tinyrl_recorder *recorder)
+{
+	/* the instance may have been reset and given another since */
+	if (tinyrl_get_recorder(recorder->tinyrl) == recorder)
+		tinyrl_set_recorder(recorder->tinyrl, NULL);
+	tinyrl__free(recorder->tinyrl, recorder);
+}
+
+static struct tinyrl_event *next_event(struct tinyrl_recorder *recorder,
+				       unsigned type)
+{
+	struct tinyrl_event *event;
+
+	/* the last head is seen before any of the slot's new contents */
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	event = &recorder->events[recorder->head & recorder->mask];
+	event->time = recorder_clock();
+	event->type = type;
+	event->len = 0;
+	return event;
+}
+
+static void publish(struct tinyrl_recorder *recorder)
+{
+	__atomic_store_n(&recorder->head, recorder->head + 1, __ATOMIC_RELEASE);
+}
+
+void tinyrl_recorder_add(struct tinyrl_recorder *recorder, unsigned type,
+			 uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+	struct tinyrl_event *event = next_event(recorder, type);
+
+	event->arg[0] = arg0;
+	event->arg[1] = arg1;
+	event->arg[2] = arg2;
+	publish(recorder);
+}
+
+void tinyrl_recorder_add_key(struct tinyrl_recorder *recorder,
+			     const char *key, size_t len)
+{
+	struct tinyrl_event *event = next_event(recorder, TINYRL_EVENT_KEY);
+
+	if (len > sizeof(event->key))
+		len = sizeof(event->key);
+	memcpy(event->key, key, len);
+	event->len = len;
+	publish(recorder);
+}
+
+/* the range of events which are complete, [*first, head) */
+static uint64_t recorder_range(const struct tinyrl_recorder *recorder,
+			       uint64_t *first)
+{
+	uint64_t head = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+
+	*first = head > recorder->mask + 1 ? head - (recorder->mask + 1) : 0;
+	return head;
+}
+
+size_t tinyrl_recorder_copy(const struct tinyrl_recorder *recorder,
+			    struct tinyrl_event *events, size_t max)
+{
+	uint64_t first, head, valid, i;
+	size_t count;
+
+	head = recorder_range(recorder, &first);
+	if (head - first > max)
+		first = head - max;
+	for (i = first; i < head; i++)
+		events[i - first] = recorder->events[i & recorder->mask];
+
+	/*
+	 * Drop anything the writer has since overwritten, including the
+	 * slot it may be filling now.  The fence keeps the copy before the
+	 * load of head.
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	valid = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+	valid = valid > recorder->mask ? valid - recorder->mask : 0;
+	if (valid <= first)
+		return head - first;
+	if (valid >= head)
+		return 0;
+	count = head - valid;
+	memmove(events, events + (valid - first), count * sizeof(*events));
+	return count;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+		p += n;
+		len -= n;
+	}
+	return true;
+}
+
+bool tinyrl_recorder_dump(const struct tinyrl_recorder *recorder, int fd)
+{
+	struct tinyrl_recorder_header header = {
+		.magic = "TRLR",
+		.version = 1,
+		.event_size = sizeof(struct tinyrl_event),
+	};
+	uint64_t first, head;
+	size_t start, len;
+
+	head = recorder_range(recorder, &first);
+	/*
+	 * Once the ring has wrapped, the oldest slot is the one a signal
+	 * may have interrupted the writer filling in, so leave it out.
+	 */
+	if (head - first == recorder->mask + 1)
+		first++;
+	header.count = head - first;
+	if (!write_all(fd, &header, sizeof(header)))
+		return false;
+
+	/* the events are at most two contiguous runs of the ring */
+	start = first & recorder->mask;
+	len = header.count;
+	if (start + len > recorder->mask + 1)
+		len = recorder->mask + 1 - start;
+	if (!write_all(fd, &recorder->events[start],
+		       len * sizeof(struct tinyrl_event)))
+		return false;
+	return write_all(fd, &recorder->events[0],
+			 (header.count - len) * sizeof(struct tinyrl_event));
+}
+
+void tinyrl_recorder_print(const struct tinyrl_recorder *recorder,
+			   FILE *stream)
+{
+	static const char *const names[] = {
+		[TINYRL_EVENT_KEY] = "key",
+		[TINYRL_EVENT_HANDLER] = "handler",
+		[TINYRL_EVENT_EDIT] = "edit",
+		[TINYRL_EVENT_REDISPLAY] = "redisplay",
+		[TINYRL_EVENT_WRITE] = "write",
+	};
+	const struct tinyrl_event *event;
+	uint64_t first, head, i;
+	unsigned j;
+
+	head = recorder_range(recorder, &first);
+	for (i = first; i < head; i++) {
+		event = &recorder->events[i & recorder->mask];
+		fprintf(stream, "%+.6f",
+			((int64_t)event->time
+			 - (int64_t)recorder->events[(head - 1) & recorder->mask].time)
+			/ 1e9);
+		if (event->type < sizeof(names) / sizeof(names[0])
+		    && names[event->type])
+			fprintf(stream, " %s", names[event->type]);
+		else
+			fprintf(stream, " event%u", event->type);
+		if (event->type == TINYRL_EVENT_KEY) {
+			for (j = 0; j < event->len; j++) {
+				unsigned char c = event->key[j];
+
+				if (isprint(c) && c != '\\')
+					fprintf(stream, j ? "%c" : " %c", c);
+				else
+					fprintf(stream, j ? "\\x%02x" : " \\x%02x", c);
+			}
+		} else {
+			fprintf(stream, " %u %u %u", event->arg[0],
+				event->arg[1], event->arg[2]);
+		}
+		fputc('\n', stream);
+	}
+}
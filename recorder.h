@@ -0,0 +1,96 @@
+/**
+  \ingroup tinyrl
+  \defgroup tinyrl_recorder recorder
+  @{
+
+  \brief This class keeps a flight recording of the most recent editor
+  events of an instance, for post-mortem analysis of hangs and glitches.
+
+*/
+#ifndef _tinyrl_recorder_h
+#define _tinyrl_recorder_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct tinyrl;
+
+enum tinyrl_event_type {
+	TINYRL_EVENT_KEY = 1,	/* key: the bytes received */
+	TINYRL_EVENT_HANDLER,	/* arg: key code, handler result */
+	TINYRL_EVENT_EDIT,	/* arg: offset, bytes removed, bytes inserted */
+	TINYRL_EVENT_REDISPLAY,	/* arg: bytes kept, rows erased, full redraw */
+	TINYRL_EVENT_WRITE,	/* arg: bytes written */
+};
+
+/**
+ * A recorded event, 24 bytes, in host byte order.
+ */
+struct tinyrl_event {
+	uint64_t time;		/* CLOCK_MONOTONIC nanoseconds */
+	uint16_t type;
+	uint16_t len;		/* bytes in key, for TINYRL_EVENT_KEY */
+	union {
+		uint32_t arg[3];
+		char key[12];
+	};
+};
+
+/**
+ * The header which tinyrl_recorder_dump() writes before the events.
+ */
+struct tinyrl_recorder_header {
+	char magic[4];		/* "TRLR" */
+	uint16_t version;	/* 1 */
+	uint16_t event_size;	/* sizeof(struct tinyrl_event) */
+	uint32_t count;		/* events which follow, oldest first */
+};
+
+/**
+ * Create a recorder for instance which keeps the most recent events
+ * (rounded up to a power of two), and attach it to the instance.
+ * Memory comes from the instance's allocator, once, here.
+ */
+struct tinyrl_recorder *tinyrl_recorder_new(struct tinyrl *tinyrl,
+					    size_t events);
+
+/**
+ * Detach the recorder from its instance, if it is still attached, and free
+ * it.  This must be done before the instance is deleted, or put in a pool
+ * which may delete it.
+ */
+void tinyrl_recorder_delete(struct tinyrl_recorder *recorder);
+
+/* record an event; these are called by the instance */
+void tinyrl_recorder_add(struct tinyrl_recorder *recorder, unsigned type,
+			 uint32_t arg0, uint32_t arg1, uint32_t arg2);
+void tinyrl_recorder_add_key(struct tinyrl_recorder *recorder,
+			     const char *key, size_t len);
+
+/**
+ * Copy up to max of the most recent events into events, oldest first,
+ * returning the number copied.  This takes no locks, so it may be called
+ * from another thread while the instance is recording: any events which
+ * are overwritten during the copy are left out.
+ */
+size_t tinyrl_recorder_copy(const struct tinyrl_recorder *recorder,
+			    struct tinyrl_event *events, size_t max);
+
+/**
+ * Write a header and the recorded events, oldest first, to fd.  Only
+ * write(2) is used, so this is safe to call from a signal handler on the
+ * instance's thread.  The result is false if a write failed.
+ */
+bool tinyrl_recorder_dump(const struct tinyrl_recorder *recorder, int fd);
+
+/**
+ * Print the recorded events, one per line, with times relative to the
+ * most recent.
+ */
+void tinyrl_recorder_print(const struct tinyrl_recorder *recorder,
+			   FILE *stream);
+
+#endif				/* _tinyrl_recorder_h */
+/** @} tinyrl_recorder */
@@ -0,0 +1,439 @@
+/*
+ * screencheck.c
+ *
+ * Check redisplay against a terminal model.  Random edits are typed into
+ * an instance which draws on a vt100 model, and after every key the
+ * screen is compared with a naive full redraw of the prompt and line on a
+ * clean screen: the same text, nothing stale left behind, and the cursor
+ * at the insertion point.  The cost of each frame is reported as JSON.
+ * Each width is checked plain and then highlighted, when the styles of
+ * every cell must match a full highlighting of the line as well, and both
+ * again with a suggestion after the line, which must be drawn dim after
+ * the cursor, accepted by Right and End, and gone once Enter is pressed.
+ *
+ * usage: tinyrl_screencheck [-s seed] [-n keys] [width...]
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tinyrl.h"
+#include "utf8.h"
+#include "vt100.h"
+
+#define ROWS 64
+#define PROMPT "prompt> "
+
+static const char *const keys[] = {
+	"a", "b", "c", "d", "e", "f", " ", " ", "x", "y", "z", "0", "1",
+	"\xe4\xb8\xad",		/* a wide character */
+	"\xc3\xa9",		/* a precomposed accent */
+	"\xcc\x81",		/* a combining accent */
+	"\x1b[D", "\x1b[D", "\x1b[C",	/* left and right */
+	"\x01", "\x05",		/* start and end of line */
+	"\x7f", "\x7f", "\x04",	/* backspace and delete */
+	"\x0b", "\x19",		/* kill and yank */
+	"\x15",			/* erase line */
+};
+#define KEYS (sizeof(keys) / sizeof(keys[0]))
+
+struct check {
+	struct tinyrl *tinyrl;
+	struct vt100 *vt;
+	unsigned width;
+	unsigned long keys_left;
+	unsigned long keys_sent;
+	unsigned long failures;
+	size_t max_line;
+	bool entered;
+	bool highlight;
+	bool suggest;
+	bool accepting;		/* the next line must be accepted */
+	char accepted[4096];
+
+	/* per frame costs */
+	unsigned long max_bytes;
+	unsigned long max_escapes;
+};
+
+static bool is_space(char c)
+{
+	return c == ' ';
+}
+
+/*
+ * Styles which depend on more than each word, to put highlighting only
+ * what has changed to the test: the first word is bold, and words with a
+ * digit are green, unless the first word starts with x, when every word
+ * after it is underlined in red instead.
+ */
+static size_t highlight(void *context, const char *line, size_t len,
+			size_t *start, size_t *end,
+			struct tinyrl_span *spans, size_t max)
+{
+	size_t i = 0, word, n = 0;
+	unsigned style;
+	bool first = true, x = false;
+
+	while (i < len) {
+		while (i < len && is_space(line[i]))
+			i++;
+		if (i == len)
+			break;
+		word = i;
+		style = 0;
+		while (i < len && !is_space(line[i])) {
+			if (line[i] >= '0' && line[i] <= '9')
+				style = 2;
+			i++;
+		}
+		if (first) {
+			/* the rest of the line depends on the first word */
+			if (*start <= i)
+				*end = len;
+			x = line[word] == 'x';
+			style = 1;
+			first = false;
+		} else if (x) {
+			style = 3;
+		}
+		if (style && i > *start && word < *end) {
+			if (n < max) {
+				spans[n].start = word;
+				spans[n].end = i;
+				spans[n].style = style;
+			}
+			n++;
+		}
+	}
+	return n;
+}
+
+/*
+ * Suggestions which depend on the length of the line, so that they come
+ * and go and change with each key.  The longest wraps at every width.
+ */
+static const char *suggest(void *context, const char *line, size_t len)
+{
+	static const char *const tails[] = {
+		NULL, "yz", " suggested",
+		" \xe4\xb8\xad\xe6\x96\x87 and a suggestion long enough to wrap",
+	};
+
+	return tails[len % 4];
+}
+
+/* draw the line as a full highlighting would */
+static void write_styled(struct vt100 *vt, const char *line, size_t len)
+{
+	static const char *const sgr[] = { "0", "0;1", "0;32", "0;4;31" };
+	struct tinyrl_span spans[256];
+	size_t start = 0, end = len, n, i, j;
+	unsigned char styles[4096];
+	char seq[16];
+
+	memset(styles, 0, len);
+	n = highlight(NULL, line, len, &start, &end, spans, 256);
+	for (i = 0; i < n && i < 256; i++)
+		memset(styles + spans[i].start, spans[i].style,
+		       spans[i].end - spans[i].start);
+	for (i = 0; i < len; i = j) {
+		for (j = i + 1; j < len && styles[j] == styles[i]; j++)
+			;
+		snprintf(seq, sizeof(seq), "\x1b[%sm", sgr[styles[i]]);
+		vt100_write(vt, seq, strlen(seq));
+		vt100_write(vt, line + i, j - i);
+	}
+	vt100_write(vt, "\x1b[0m", 4);
+}
+
+/*
+ * Draw the prompt and the line on a clean screen, with the suggestion if
+ * there is to be one, and return the length of the text drawn.
+ */
+static size_t write_line(const struct check *check, struct vt100 *vt,
+			 const char *line, size_t end, bool suggested,
+			 char *text, size_t size)
+{
+	const char *tail = suggested ? suggest(NULL, line, end) : NULL;
+	size_t len = end;
+
+	vt100_write(vt, PROMPT, strlen(PROMPT));
+	if (check->highlight)
+		write_styled(vt, line, end);
+	else
+		vt100_write(vt, line, end);
+	memcpy(text, line, end);
+	if (tail && end + strlen(tail) < size) {
+		vt100_write(vt, "\x1b[0;2m", 6);
+		vt100_write(vt, tail, strlen(tail));
+		vt100_write(vt, "\x1b[0m", 4);
+		memcpy(text + end, tail, strlen(tail));
+		len += strlen(tail);
+	}
+	text[len] = '\0';
+	return len;
+}
+
+/* where a naive redraw would leave the cursor: at the next grapheme */
+static void expected_cursor(const struct check *check, const char *line,
+			    unsigned point, unsigned end,
+			    unsigned *row, unsigned *col)
+{
+	struct vt100 *vt = vt100_new(ROWS, check->width);
+
+	vt100_write(vt, PROMPT, strlen(PROMPT));
+	vt100_write(vt, line, point);
+	vt100_get_cursor(vt, row, col);
+	if (*col == check->width
+	    || (point < end && *col + utf8_grapheme_width(line, end, point, NULL)
+		> check->width)) {
+		*row += 1;
+		*col = 0;
+	}
+	vt100_delete(vt);
+}
+
+static void verify(struct check *check)
+{
+	const char *line = tinyrl_get_line(check->tinyrl);
+	unsigned point = tinyrl_get_point(check->tinyrl);
+	unsigned end = strlen(line);
+	struct vt100 *expect;
+	struct vt100_stats frame;
+	char got[4096], want[4096], text[4096];
+	unsigned row, col, want_row, want_col, text_end;
+	bool ok = true;
+
+	vt100_get_stats(check->vt, &frame, NULL);
+	if (frame.bytes > check->max_bytes)
+		check->max_bytes = frame.bytes;
+	if (frame.escapes > check->max_escapes)
+		check->max_escapes = frame.escapes;
+	if (frame.unknown)
+		ok = false;
+
+	/* the cursor stays on the line, before any suggestion */
+	expect = vt100_new(ROWS, check->width);
+	text_end = write_line(check, expect, line, end,
+			      check->suggest && end && point == end,
+			      text, sizeof(text));
+	for (row = 0; row < ROWS; row++) {
+		vt100_get_row(check->vt, row, got, sizeof(got));
+		vt100_get_row(expect, row, want, sizeof(want));
+		if (strcmp(got, want) != 0)
+			ok = false;
+		for (col = 0; col < check->width; col++)
+			if (vt100_get_attr(check->vt, row, col)
+			    != vt100_get_attr(expect, row, col))
+				ok = false;
+	}
+	if (vt100_get_pen(check->vt))
+		ok = false;
+	vt100_delete(expect);
+
+	vt100_get_cursor(check->vt, &row, &col);
+	expected_cursor(check, text, point, text_end, &want_row, &want_col);
+	if (row != want_row || col != want_col)
+		ok = false;
+	if (check->accepting && strcmp(line, check->accepted) != 0)
+		ok = false;
+	check->accepting = false;
+
+	if (!ok) {
+		check->failures++;
+		fprintf(stderr, "width %u%s%s, key %lu: line \"%s\" point %u, "
+			"expected cursor %u,%u\n", check->width,
+			check->highlight ? " highlighted" : "",
+			check->suggest ? " suggested" : "",
+			check->keys_sent, line, point, want_row, want_col);
+		vt100_print(check->vt, stderr);
+	}
+}
+
+/* once Enter is pressed, only the line is left, and the cursor below it */
+static void verify_entered(struct check *check, const char *line)
+{
+	struct vt100 *expect;
+	char got[4096], want[4096], text[4096];
+	unsigned row, col, want_row, want_col;
+	bool ok = true;
+
+	expect = vt100_new(ROWS, check->width);
+	write_line(check, expect, line, strlen(line), false,
+		   text, sizeof(text));
+	vt100_write(expect, "\r\n", 2);
+	for (row = 0; row < ROWS; row++) {
+		vt100_get_row(check->vt, row, got, sizeof(got));
+		vt100_get_row(expect, row, want, sizeof(want));
+		if (strcmp(got, want) != 0)
+			ok = false;
+		for (col = 0; col < check->width; col++)
+			if (vt100_get_attr(check->vt, row, col)
+			    != vt100_get_attr(expect, row, col))
+				ok = false;
+	}
+	vt100_get_cursor(check->vt, &row, &col);
+	vt100_get_cursor(expect, &want_row, &want_col);
+	if (row != want_row || col != want_col)
+		ok = false;
+	vt100_delete(expect);
+
+	if (!ok) {
+		check->failures++;
+		fprintf(stderr, "width %u%s%s, entered: line \"%s\", "
+			"expected cursor %u,%u\n", check->width,
+			check->highlight ? " highlighted" : "",
+			check->suggest ? " suggested" : "",
+			line, want_row, want_col);
+		vt100_print(check->vt, stderr);
+	}
+}
+
+/* Right or End is about to be pressed, which accepts a suggestion shown */
+static void expect_accept(struct check *check)
+{
+	const char *line = tinyrl_get_line(check->tinyrl);
+	size_t end = strlen(line);
+	const char *tail = suggest(NULL, line, end);
+
+	if (!end || tinyrl_get_point(check->tinyrl) != end || !tail
+	    || end + strlen(tail) >= sizeof(check->accepted))
+		return;
+	memcpy(check->accepted, line, end);
+	strcpy(check->accepted + end, tail);
+	check->accepting = true;
+}
+
+static int check_read(void *context, char *buf, size_t len, bool block)
+{
+	struct check *check = context;
+	const char *key;
+	size_t n;
+
+	/* the display has been flushed by the time a new key is wanted */
+	if (!block)
+		return 0;
+	if (check->keys_sent)
+		verify(check);
+
+	if (!check->keys_left) {
+		if (check->entered)
+			return -1;
+		check->entered = true;
+		buf[0] = '\r';
+		return 1;
+	}
+
+	/*
+	 * Keep the line from scrolling the screen.  A combining mark is not
+	 * typed at the start of the line, where it would combine with the
+	 * prompt.
+	 */
+	key = keys[rand() % KEYS];
+	if (key[0] == '\xcc' && tinyrl_get_point(check->tinyrl) == 0)
+		key = "a";
+	if (strlen(tinyrl_get_line(check->tinyrl)) > check->max_line)
+		key = "\x15";
+	if (check->suggest && (!strcmp(key, "\x1b[C") || !strcmp(key, "\x05")))
+		expect_accept(check);
+	n = strlen(key);
+	if (n > len)
+		n = len;
+	memcpy(buf, key, n);
+	check->keys_left--;
+	check->keys_sent++;
+	return n;
+}
+
+/* the instance draws on the terminal model */
+static void check_write(void *context, const char *buf, size_t len)
+{
+	struct check *check = context;
+
+	vt100_write(check->vt, buf, len);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned default_widths[] = { 7, 10, 13, 20, 80 };
+	const unsigned *widths = default_widths;
+	size_t nwidths = sizeof(default_widths) / sizeof(default_widths[0]);
+	unsigned *arg_widths = NULL;
+	unsigned long nkeys = 20000, failures = 0;
+	unsigned seed = 1;
+	struct vt100_stats total;
+	struct check check;
+	const char *line;
+	size_t i;
+	int arg, pass;
+
+	for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (strcmp(argv[arg], "-s") == 0 && arg + 1 < argc) {
+			seed = strtoul(argv[++arg], NULL, 10);
+		} else if (strcmp(argv[arg], "-n") == 0 && arg + 1 < argc) {
+			nkeys = strtoul(argv[++arg], NULL, 10);
+		} else {
+			fprintf(stderr, "usage: %s [-s seed] [-n keys] "
+				"[width...]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (arg < argc) {
+		nwidths = argc - arg;
+		arg_widths = calloc(nwidths, sizeof(*arg_widths));
+		if (!arg_widths)
+			return 1;
+		for (i = 0; i < nwidths; i++)
+			arg_widths[i] = strtoul(argv[arg + i], NULL, 10);
+		widths = arg_widths;
+	}
+
+	for (i = 0; i < nwidths; i++)
+	for (pass = 0; pass < 4; pass++) {
+		srand(seed);
+		memset(&check, 0, sizeof(check));
+		check.highlight = pass & 1;
+		check.suggest = pass & 2;
+		check.width = widths[i];
+		check.keys_left = nkeys;
+		check.max_line = check.width * (ROWS / 4);
+		check.vt = vt100_new(ROWS, check.width);
+		check.tinyrl = tinyrl_new_io(check_read, check_write, &check);
+		if (!check.vt || !check.tinyrl)
+			return 1;
+		tinyrl_set_width(check.tinyrl, check.width);
+		if (check.highlight) {
+			tinyrl_set_style(check.tinyrl, 1, "1");
+			tinyrl_set_style(check.tinyrl, 2, "32");
+			tinyrl_set_style(check.tinyrl, 3, "4;31");
+			tinyrl_set_highlight(check.tinyrl, highlight, NULL);
+		}
+		if (check.suggest)
+			tinyrl_set_suggest(check.tinyrl, suggest, NULL);
+		line = tinyrl_readline_ref(check.tinyrl, PROMPT, NULL);
+		if (line)
+			verify_entered(&check, line);
+		else
+			check.failures++;
+
+		vt100_get_stats(check.vt, NULL, &total);
+		printf("{\"width\": %u, \"highlight\": %s, \"suggest\": %s, "
+		       "\"keys\": %lu, "
+		       "\"failures\": %lu, "
+		       "\"bytes_per_frame\": %.1f, \"escapes_per_frame\": %.2f, "
+		       "\"max_bytes\": %lu, \"max_escapes\": %lu}\n",
+		       check.width, check.highlight ? "true" : "false",
+		       check.suggest ? "true" : "false",
+		       check.keys_sent, check.failures,
+		       (double)total.bytes / total.frames,
+		       (double)total.escapes / total.frames,
+		       check.max_bytes, check.max_escapes);
+		failures += check.failures;
+
+		tinyrl_delete(check.tinyrl);
+		vt100_delete(check.vt);
+	}
+	free(arg_widths);
+	return failures ? 1 : 0;
+}
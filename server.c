@@ -0,0 +1,413 @@
+/*
+ * server.c
+ *
+ * A multi-session CLI server: every connection to a loopback TCP port
+ * gets its own tinyrl session with history, and all of them are served by
+ * one thread using epoll and tinyrl_line_process().  Each line entered is
+ * answered with "ok".  Instances are reused from a pool as connections come
+ * and go.  Use tinyrl_loadgen to drive it.
+ *
+ * usage: tinyrl_server [-p port] [-i report seconds]
+ *
+ * Every report interval, and on exit (SIGINT or SIGTERM), a JSON line is
+ * printed with the sessions, throughput, memory per session and the tail
+ * latency of handling input, from a socket becoming readable to the
+ * output being written.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include "tinyrl.h"
+#include "history.h"
+#include "pool.h"
+
+#define MAX_EVENTS 256
+#define POOL_SIZE 256
+
+struct session {
+	struct session *next;
+	struct session *prev;
+	int fd;
+	struct tinyrl *tinyrl;
+	struct tinyrl_history *history;
+
+	/* output which the socket has not yet accepted */
+	char *pending;
+	size_t pending_len;
+	size_t pending_size;
+	bool closing;
+	bool waiting;		/* for the rest of an escape sequence */
+};
+
+struct server {
+	int epoll;
+	struct tinyrl_pool *pool;
+	struct session *first;
+	size_t sessions;
+	size_t waiting;		/* sessions with a line timeout */
+	unsigned long keys;
+	unsigned long lines;
+	struct tinyrl_histogram latency;	/* nanoseconds */
+};
+
+static struct server server;
+static volatile sig_atomic_t stopping;
+
+static uint64_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void histogram_add(struct tinyrl_histogram *histogram, uint64_t value)
+{
+	unsigned bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+	if (bucket >= TINYRL_HISTOGRAM_BUCKETS)
+		bucket = TINYRL_HISTOGRAM_BUCKETS - 1;
+	histogram->bucket[bucket]++;
+	histogram->count++;
+	histogram->sum += value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+static int session_read(void *context, char *buf, size_t len, bool block)
+{
+	struct session *session = context;
+	ssize_t n;
+
+	n = recv(session->fd, buf, len, 0);
+	if (n > 0) {
+		server.keys += n;
+		return n;
+	}
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	return -1;
+}
+
+static void watch(struct session *session, uint32_t events)
+{
+	struct epoll_event ev = { .events = events, .data.ptr = session };
+
+	epoll_ctl(server.epoll, EPOLL_CTL_MOD, session->fd, &ev);
+}
+
+static void session_write(void *context, const char *buf, size_t len)
+{
+	struct session *session = context;
+	ssize_t n = 0;
+	size_t size;
+	char *pending;
+
+	if (!session->pending_len) {
+		n = send(session->fd, buf, len, MSG_NOSIGNAL);
+		if (n < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				session->closing = true;
+				return;
+			}
+			n = 0;
+		}
+		if ((size_t)n == len)
+			return;
+	}
+
+	/* keep the rest until the socket is writable */
+	len -= n;
+	if (session->pending_len + len > session->pending_size) {
+		size = session->pending_size ? session->pending_size : 256;
+		while (size < session->pending_len + len)
+			size *= 2;
+		pending = realloc(session->pending, size);
+		if (!pending) {
+			session->closing = true;
+			return;
+		}
+		session->pending = pending;
+		session->pending_size = size;
+	}
+	memcpy(session->pending + session->pending_len, buf + n, len);
+	if (!session->pending_len)
+		watch(session, EPOLLIN | EPOLLOUT);
+	session->pending_len += len;
+}
+
+static void send_pending(struct session *session)
+{
+	ssize_t n;
+
+	n = send(session->fd, session->pending, session->pending_len,
+		 MSG_NOSIGNAL);
+	if (n < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK)
+			session->closing = true;
+		return;
+	}
+	memmove(session->pending, session->pending + n,
+		session->pending_len - n);
+	session->pending_len -= n;
+	if (!session->pending_len)
+		watch(session, EPOLLIN);
+}
+
+static void session_close(struct session *session)
+{
+	epoll_ctl(server.epoll, EPOLL_CTL_DEL, session->fd, NULL);
+	close(session->fd);
+	if (session->prev)
+		session->prev->next = session->next;
+	else
+		server.first = session->next;
+	if (session->next)
+		session->next->prev = session->prev;
+	if (session->waiting)
+		server.waiting--;
+	tinyrl_history_delete(session->history);
+	tinyrl_pool_put(server.pool, session->tinyrl);
+	free(session->pending);
+	free(session);
+	server.sessions--;
+}
+
+/* handle all the lines in the input received so far */
+static void session_input(struct session *session)
+{
+	const char *line;
+	size_t len;
+
+	while (!session->closing
+	       && tinyrl_line_process(session->tinyrl, &line, &len)) {
+		if (!line) {
+			session->closing = true;
+			break;
+		}
+		server.lines++;
+		if (len)
+			tinyrl_history_add(session->history, line);
+		tinyrl_printf(session->tinyrl, "ok\n");
+		tinyrl_line_begin(session->tinyrl, "> ");
+	}
+	if (session->waiting)
+		server.waiting--;
+	session->waiting = tinyrl_line_timeout(session->tinyrl) >= 0;
+	if (session->waiting)
+		server.waiting++;
+}
+
+/*
+ * Give the sessions waiting for the rest of an escape sequence whose time
+ * is up another look.  The result is the epoll timeout for the next.
+ */
+static int session_timeouts(void)
+{
+	struct session *session, *next;
+	int timeout = 100, ms;
+
+	for (session = server.first; session && server.waiting; session = next) {
+		next = session->next;
+		if (!session->waiting)
+			continue;
+		ms = tinyrl_line_timeout(session->tinyrl);
+		if (ms == 0) {
+			session_input(session);
+			if (session->closing) {
+				session_close(session);
+				continue;
+			}
+			ms = tinyrl_line_timeout(session->tinyrl);
+		}
+		if (ms >= 0 && ms < timeout)
+			timeout = ms;
+	}
+	return timeout;
+}
+
+static void session_open(int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN };
+	struct session *session;
+	int one = 1;
+
+	session = calloc(1, sizeof(*session));
+	if (!session) {
+		close(fd);
+		return;
+	}
+	session->fd = fd;
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	session->tinyrl = tinyrl_pool_get(server.pool, session_read,
+					  session_write, session);
+	if (!session->tinyrl) {
+		close(fd);
+		free(session);
+		return;
+	}
+	tinyrl_set_width(session->tinyrl, 80);
+	session->history = tinyrl_history_new(session->tinyrl, 100);
+
+	ev.data.ptr = session;
+	epoll_ctl(server.epoll, EPOLL_CTL_ADD, fd, &ev);
+	session->next = server.first;
+	if (server.first)
+		server.first->prev = session;
+	server.first = session;
+	server.sessions++;
+	tinyrl_line_begin(session->tinyrl, "> ");
+}
+
+static size_t rss_bytes(void)
+{
+	unsigned long size, resident = 0;
+	FILE *f = fopen("/proc/self/statm", "r");
+
+	if (f) {
+		if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+			resident = 0;
+		fclose(f);
+	}
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* the memory held by a session and its instance and history */
+static size_t session_bytes(const struct session *session)
+{
+	struct tinyrl_stats stats;
+	struct tinyrl_history_stats history_stats;
+
+	tinyrl_get_stats(session->tinyrl, &stats);
+	tinyrl_history_get_stats(session->history, &history_stats);
+	return sizeof(*session) + session->pending_size
+		+ stats.total_bytes + history_stats.total_bytes;
+}
+
+static void report(double seconds, unsigned long keys, unsigned long lines)
+{
+	const struct session *session;
+	size_t bytes = 0;
+
+	for (session = server.first; session; session = session->next)
+		bytes += session_bytes(session);
+
+	printf("{\"sessions\": %zu, \"keys_per_sec\": %.0f, "
+	       "\"lines_per_sec\": %.0f, \"bytes_per_session\": %.0f, "
+	       "\"rss_bytes\": %zu, \"latency_us\": {\"p50\": %.1f, "
+	       "\"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f}}\n",
+	       server.sessions, keys / seconds, lines / seconds,
+	       server.sessions ? (double)bytes / server.sessions : 0,
+	       rss_bytes(),
+	       tinyrl_histogram_percentile(&server.latency, 0.5) / 1000.0,
+	       tinyrl_histogram_percentile(&server.latency, 0.99) / 1000.0,
+	       tinyrl_histogram_percentile(&server.latency, 0.999) / 1000.0,
+	       server.latency.max / 1000.0);
+	fflush(stdout);
+	memset(&server.latency, 0, sizeof(server.latency));
+}
+
+static void stop(int sig)
+{
+	stopping = 1;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr = { .sin_family = AF_INET };
+	struct epoll_event events[MAX_EVENTS], ev = { .events = EPOLLIN };
+	unsigned port = 7777, interval = 5;
+	unsigned long last_keys = 0, last_lines = 0;
+	uint64_t start, last_report, t;
+	int listener, fd, n, i, opt, timeout = 100, one = 1;
+
+	while ((opt = getopt(argc, argv, "p:i:")) != -1) {
+		switch (opt) {
+		case 'p':
+			port = strtoul(optarg, NULL, 10);
+			break;
+		case 'i':
+			interval = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-i seconds]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGPIPE, SIG_IGN);
+
+	listener = socket(AF_INET, SOCK_STREAM, 0);
+	setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	    || listen(listener, 1024) < 0) {
+		perror("listen");
+		return 1;
+	}
+	fcntl(listener, F_SETFL, fcntl(listener, F_GETFL, 0) | O_NONBLOCK);
+
+	server.pool = tinyrl_pool_new(NULL, POOL_SIZE);
+	server.epoll = epoll_create1(0);
+	ev.data.ptr = NULL;
+	epoll_ctl(server.epoll, EPOLL_CTL_ADD, listener, &ev);
+
+	start = last_report = now();
+	while (!stopping) {
+		n = epoll_wait(server.epoll, events, MAX_EVENTS, timeout);
+		for (i = 0; i < n; i++) {
+			struct session *session = events[i].data.ptr;
+
+			if (!session) {
+				while ((fd = accept(listener, NULL, NULL)) >= 0)
+					session_open(fd);
+				continue;
+			}
+			t = now();
+			if (events[i].events & EPOLLOUT)
+				send_pending(session);
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+				session_input(session);
+				histogram_add(&server.latency, now() - t);
+			}
+			if (session->closing)
+				session_close(session);
+		}
+		timeout = server.waiting ? session_timeouts() : 100;
+
+		t = now();
+		if (interval && t - last_report >= interval * 1000000000ULL) {
+			report((t - last_report) / 1e9, server.keys - last_keys,
+			       server.lines - last_lines);
+			last_keys = server.keys;
+			last_lines = server.lines;
+			last_report = t;
+		}
+	}
+
+	t = now();
+	report((t - start) / 1e9, server.keys, server.lines);
+	while (server.first)
+		session_close(server.first);
+	tinyrl_pool_delete(server.pool);
+	close(server.epoll);
+	close(listener);
+	return 0;
+}
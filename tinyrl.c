@@ -1,30 +1,83 @@
 #include "tinyrl.h"
+#include "mempool.h"
+#include "recorder.h"
 #include "utf8.h"
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
 
-#define KEYMAP_SIZE 256
+/*
+ * key codes: single bytes, followed by the special keys with each
+ * combination of modifiers
+ */
+#define KEY_SPECIAL 256
+#define KEY_MODIFIERS 8
+#define KEY_CODES (KEY_SPECIAL + TINYRL_KEYS * KEY_MODIFIERS)
+#define SPECIAL(key, modifiers) (KEY_SPECIAL + (key) * KEY_MODIFIERS + (modifiers))
+#define INPUT_SIZE 256
+#define DEFAULT_ESCAPE_TIMEOUT 100	/* ms */
+
+#ifdef TINYRL_STATIC_MEMORY
+/* bound the memory needed when there is no heap to fall back on */
+#define DEFAULT_LINE_LENGTH 256
+#define BATCH_INPUT_SIZE INPUT_SIZE
+#else
+#define DEFAULT_LINE_LENGTH 0
+#define BATCH_INPUT_SIZE 65536
+#endif
+
+/* a binding which differs from the default keymap */
+struct tinyrl_binding {
+	unsigned code;
+	tinyrl_key_func_t *handler;
+	void *context;
+};
 
-struct tinyrl_keymap {
-	tinyrl_key_func_t *handler[KEYMAP_SIZE];
-	struct tinyrl_keymap *keymap[KEYMAP_SIZE];
-	void *context[KEYMAP_SIZE];
+/* a message posted from another thread */
+struct tinyrl_message {
+	struct tinyrl_message *next;
+	size_t len;
+	char text[];
 };
 
 /* define the class member data and virtual methods */
 struct tinyrl {
+	struct tinyrl_allocator alloc;
+	unsigned long allocs;
+	unsigned long frees;
+	size_t trim_threshold;
 	FILE *istream;
 	FILE *ostream;
+	tinyrl_read_func_t *read;
+	void *read_context;
+	char *input;
+	size_t input_size;
+	size_t input_pos;
+	size_t input_len;
+	bool batch_echo;
+	tinyrl_write_func_t *write;
+	void *write_context;
+	char *output;
+	size_t output_len;
+	size_t output_size;
+	bool reading;
+	bool restored;		/* the next line starts with a restored one */
+	size_t width;
+	struct termios default_termios;
+	bool raw_mode;
+	bool session;
 	const char *line;
 	unsigned max_line_length;
 	const char *prompt;
@@ -34,22 +87,319 @@ struct tinyrl {
 	unsigned point;
 	unsigned end;
 	char *kill_string;
-	struct tinyrl_keymap *keymap;
+	size_t kill_size;
+	struct tinyrl_binding *bindings;	/* sorted by code */
+	unsigned bindings_len;
+	unsigned bindings_size;
 
 	char echo_char;
 	bool echo_enabled;
 	bool isatty;
 
+	char *display;
+	size_t display_size;
 	char *last_buffer;
+	size_t last_size;
+	bool last_valid;
+
+	/* the measurements of the line, while it is text set with them */
+	const char *layout_line;
+	struct tinyrl_line_layout layout;
+
+	/* highlighting: the style of each byte of the line, and of the display */
+	tinyrl_highlight_func_t *highlight;
+	void *highlight_context;
+	const char *style_sgr[TINYRL_STYLES + 1];
+	char *styles;
+	size_t styles_size;
+	size_t styles_len;	/* the length of the line which styles is for */
+	bool dirty;		/* the region to highlight again */
+	size_t dirty_start;
+	size_t dirty_end;
+	char *spans;		/* an array of struct tinyrl_span */
+	size_t spans_size;
+	char *display_styles;
+	size_t display_styles_size;
+	char *last_styles;
+	size_t last_styles_size;
+	bool display_styled;
+	bool last_styled;
+
+	/* suggestions: text shown after the line which a key can accept */
+	tinyrl_suggest_func_t *suggest;
+	void *suggest_context;
+	const char *suggestion;
+	size_t suggestion_len;
+	bool suggest_valid;	/* suggestion is for the line as it is */
+	bool suggest_hidden;
+	bool display_suggested;
+	bool last_suggested;
 	size_t last_end;
 	size_t last_row;
 	size_t last_point_row;
+
+	/* messages posted by other threads, newest first */
+	struct tinyrl_message *posted;
+	tinyrl_notify_func_t *post_notify;
+	void *post_context;
+	int wake[2];		/* a pipe to wake a blocked stdio read */
+
+	uint64_t escape_time;	/* when a pending ESC arrived, or 0 */
+	unsigned escape_timeout;	/* ms to wait for the rest of a sequence */
+
+	tinyrl_edit_func_t *edit_observer;
+	void *edit_context;
+
+	struct tinyrl_recorder *recorder;
+	struct tinyrl_usage *usage;
+#ifdef TINYRL_LATENCY_STATS
+	struct tinyrl_latency latency;
+	uint64_t key_time;	/* when the key being handled arrived */
+#endif
 };
 
+static bool tinyrl_extend_line_buffer(struct tinyrl *this, unsigned len);
+
+static uint64_t tinyrl_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef TINYRL_LATENCY_STATS
+
+static void tinyrl_histogram_add(struct tinyrl_histogram *histogram,
+				 uint64_t value)
+{
+	unsigned bucket = value ? 64 - __builtin_clzll(value) : 0;
+
+	if (bucket >= TINYRL_HISTOGRAM_BUCKETS)
+		bucket = TINYRL_HISTOGRAM_BUCKETS - 1;
+	histogram->bucket[bucket]++;
+	histogram->count++;
+	histogram->sum += value;
+	if (value > histogram->max)
+		histogram->max = value;
+}
+
+/* time a stage of the keystroke path */
+#define LATENCY_BEGIN(start) uint64_t start = tinyrl_clock()
+#define LATENCY_END(this, which, start) \
+	tinyrl_histogram_add(&(this)->latency.stage[which], \
+			     tinyrl_clock() - (start))
+#define LATENCY_BYTES(this, bytes) \
+	tinyrl_histogram_add(&(this)->latency.frame_bytes, bytes)
+#define LATENCY_KEY_BEGIN(this) ((this)->key_time = tinyrl_clock())
+#define LATENCY_KEY_END(this) do { \
+	if ((this)->key_time) { \
+		LATENCY_END(this, TINYRL_LATENCY_KEY, (this)->key_time); \
+		(this)->key_time = 0; \
+	} \
+} while (0)
+#else
+#define LATENCY_BEGIN(start) do { } while (0)
+#define LATENCY_END(this, which, start) do { } while (0)
+#define LATENCY_BYTES(this, bytes) do { } while (0)
+#define LATENCY_KEY_BEGIN(this) do { } while (0)
+#define LATENCY_KEY_END(this) do { } while (0)
+#endif
+
+/* add an event to the flight recorder, if there is one */
+#define RECORD(this, type, arg0, arg1, arg2) do { \
+	if ((this)->recorder) \
+		tinyrl_recorder_add((this)->recorder, TINYRL_EVENT_##type, \
+				    arg0, arg1, arg2); \
+} while (0)
+
 #define ESCAPESTR "\x1b"
 #define ESCAPE 27
 #define BACKSPACE 127
 
+#ifndef TINYRL_STATIC_MEMORY
+static void *tinyrl_libc_malloc(void *context, size_t size)
+{
+	return malloc(size);
+}
+
+static void *tinyrl_libc_realloc(void *context, void *ptr, size_t size)
+{
+	return realloc(ptr, size);
+}
+
+static void tinyrl_libc_free(void *context, void *ptr)
+{
+	free(ptr);
+}
+
+static const struct tinyrl_allocator tinyrl_libc_allocator = {
+	.malloc = tinyrl_libc_malloc,
+	.realloc = tinyrl_libc_realloc,
+	.free = tinyrl_libc_free,
+};
+#endif
+
+/*
+ * The allocation counts are statistics, so they are updated even through
+ * a const reference (instances are never defined const).
+ */
+void *tinyrl__malloc(const struct tinyrl *this, size_t size)
+{
+	((struct tinyrl *)this)->allocs++;
+	return this->alloc.malloc(this->alloc.context, size);
+}
+
+void *tinyrl__realloc(const struct tinyrl *this, void *ptr, size_t size)
+{
+	((struct tinyrl *)this)->allocs++;
+	return this->alloc.realloc(this->alloc.context, ptr, size);
+}
+
+void tinyrl__free(const struct tinyrl *this, void *ptr)
+{
+	if (ptr) {
+		((struct tinyrl *)this)->frees++;
+		this->alloc.free(this->alloc.context, ptr);
+	}
+}
+
+char *tinyrl__strdup(const struct tinyrl *this, const char *s)
+{
+	size_t len = strlen(s) + 1;
+	char *p;
+
+	p = tinyrl__malloc(this, len);
+	if (p)
+		memcpy(p, s, len);
+	return p;
+}
+
+/*
+ * Ensure that a scratch buffer can hold len bytes.  It grows geometrically
+ * and is never shrunk, so that it settles at the largest size needed.
+ */
+static bool tinyrl_reserve(struct tinyrl *this, char **buf, size_t *size,
+			   size_t len)
+{
+	size_t new_size;
+	char *new_buf;
+
+	if (*size >= len)
+		return true;
+	new_size = *size ? *size : 16;
+	while (new_size < len)
+		new_size *= 2;
+	new_buf = tinyrl__realloc(this, *buf, new_size);
+	if (!new_buf)
+		return false;
+	*buf = new_buf;
+	*size = new_size;
+	return true;
+}
+
+/*
+ * Wait for the terminal to be readable, or for a message to be posted.
+ * The result is false if there are messages to print first.
+ */
+static bool tinyrl_stdio_wait(struct tinyrl *this, int fd)
+{
+	struct pollfd fds[2] = {
+		{ .fd = fd, .events = POLLIN },
+		{ .fd = this->wake[0], .events = POLLIN },
+	};
+	char buf[16];
+
+	if (this->wake[0] < 0 || !this->isatty)
+		return true;
+	for (;;) {
+		if (__atomic_load_n(&this->posted, __ATOMIC_ACQUIRE))
+			return false;
+		if (poll(fds, 2, -1) < 0 && errno != EINTR)
+			return true;
+		if (fds[1].revents)
+			while (read(this->wake[0], buf, sizeof(buf)) > 0)
+				;
+		if (fds[0].revents)
+			return true;
+	}
+}
+
+static int tinyrl_stdio_read(void *context, char *buf, size_t len, bool block)
+{
+	struct tinyrl *this = context;
+	FILE *istream = this->istream;
+	int fd = fileno(istream);
+	int flags = -1;
+	ssize_t n;
+
+	if (fd < 0) {
+		/* not backed by a descriptor, so it can't block on a terminal */
+		n = fread(buf, 1, len, istream);
+		return n ? n : -1;
+	}
+	if (block && !tinyrl_stdio_wait(this, fd))
+		return 0;
+
+	if (!block) {
+		flags = fcntl(fd, F_GETFL, 0);
+		if (flags != -1)
+			fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+	}
+	do {
+		n = read(fd, buf, len);
+	} while (n < 0 && errno == EINTR && block);
+	if (flags != -1)
+		fcntl(fd, F_SETFL, flags);
+
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return 0;
+	return n > 0 ? n : -1;
+}
+
+static void tinyrl_stdio_write(void *context, const char *buf, size_t len)
+{
+	FILE *ostream = context;
+
+	fwrite(buf, 1, len, ostream);
+	fflush(ostream);
+}
+
+/*
+ * Ensure that the output buffer has room for len more bytes.
+ */
+static bool tinyrl_extend_output(struct tinyrl *this, size_t len)
+{
+	return tinyrl_reserve(this, &this->output, &this->output_size,
+			      this->output_len + len);
+}
+
+/*
+ * Deliver everything buffered so far to the output sink as a single frame.
+ */
+static void tinyrl_flush(struct tinyrl *this)
+{
+	if (this->output_len) {
+		LATENCY_BEGIN(start);
+
+		this->write(this->write_context, this->output, this->output_len);
+		LATENCY_END(this, TINYRL_LATENCY_FLUSH, start);
+		LATENCY_BYTES(this, this->output_len);
+		RECORD(this, WRITE, this->output_len, 0, 0);
+		this->output_len = 0;
+	}
+}
+
+static void tinyrl_write(struct tinyrl *this, const char *buf, size_t len)
+{
+	if (!tinyrl_extend_output(this, len))
+		return;
+	memcpy(this->output + this->output_len, buf, len);
+	this->output_len += len;
+	if (!this->reading)
+		tinyrl_flush(this);
+}
+
 static void tinyrl_vt100_clear_screen(struct tinyrl *this)
 {
 	tinyrl_printf(this, "\x1b[2J");
@@ -80,37 +430,63 @@ static void tinyrl_vt100_cursor_forward(struct tinyrl *this, unsigned count)
 	tinyrl_printf(this, "\x1b[%dC", count);
 }
 
+static void tinyrl_vt100_erase_down(struct tinyrl *this)
+{
+	tinyrl_printf(this, "\x1b[J");
+}
+
 static void tinyrl_vt100_cursor_home(struct tinyrl *this)
 {
 	tinyrl_printf(this, "\x1b[H");
 }
 
-static void tty_set_raw_mode(FILE *istream, struct termios *old_termios)
+/*
+ * Mode switches use TCSADRAIN rather than TCSAFLUSH so that any input
+ * typed ahead of the switch is kept.
+ */
+static bool tty_set_raw_mode(FILE *istream, struct termios *old_termios)
 {
 	struct termios new_termios;
 	int fd = fileno(istream);
 	int status;
 
 	status = tcgetattr(fd, old_termios);
-	if (-1 != status) {
-		status = tcgetattr(fd, &new_termios);
-		assert(-1 != status);
-		new_termios.c_iflag = 0;
-		new_termios.c_oflag = OPOST | ONLCR;
-		new_termios.c_lflag = 0;
-		new_termios.c_cc[VMIN] = 1;
-		new_termios.c_cc[VTIME] = 0;
-		/* Do the mode switch */
-		status = tcsetattr(fd, TCSAFLUSH, &new_termios);
-		assert(-1 != status);
-	}
+	if (-1 == status)
+		return false;
+
+	new_termios = *old_termios;
+	new_termios.c_iflag = 0;
+	new_termios.c_oflag = OPOST | ONLCR;
+	new_termios.c_lflag = 0;
+	new_termios.c_cc[VMIN] = 1;
+	new_termios.c_cc[VTIME] = 0;
+	/* Do the mode switch */
+	status = tcsetattr(fd, TCSADRAIN, &new_termios);
+	assert(-1 != status);
+	return true;
 }
 
 static void tty_restore_mode(FILE *istream, struct termios *old_termios)
 {
 	int fd = fileno(istream);
 
-	tcsetattr(fd, TCSAFLUSH, old_termios);
+	tcsetattr(fd, TCSADRAIN, old_termios);
+}
+
+static void tinyrl_enter_raw_mode(struct tinyrl *this)
+{
+	/* only a stdio source has a terminal for us to manage */
+	if (this->istream && !this->raw_mode)
+		this->raw_mode = tty_set_raw_mode(this->istream,
+						  &this->default_termios);
+}
+
+static void tinyrl_leave_raw_mode(struct tinyrl *this)
+{
+	if (this->raw_mode) {
+		tty_restore_mode(this->istream, &this->default_termios);
+		this->raw_mode = false;
+	}
 }
 
 /*
@@ -118,18 +494,77 @@ static void tty_restore_mode(FILE *istream, struct termios *old_termios)
    It signals that if we are currently viewing a history line we should transfer it
    to the current buffer
    */
-static void changed_line(struct tinyrl *this)
+static bool changed_line(struct tinyrl *this)
 {
+	const char *line = this->line;
+
 	/* if the current line is not our buffer then make it so */
-	if (this->line != this->buffer) {
-		/* replace the current buffer with the new details */
-		free(this->buffer);
-		this->line = this->buffer = strdup(this->line);
-		this->buffer_size = strlen(this->buffer);
-		assert(this->line);
+	if (line != this->buffer) {
+		/* copy the current line into the buffer, reusing its memory */
+		if (!tinyrl_extend_line_buffer(this, this->end))
+			return false;
+		memcpy(this->buffer, line, this->end + 1);
+		this->line = this->buffer;
+	}
+	return true;
+}
+
+/* where a position in the line is after an edit */
+static size_t tinyrl_edit_pos(size_t pos, size_t offset,
+			      size_t removed, size_t inserted)
+{
+	if (pos >= offset + removed)
+		return pos - removed + inserted;
+	return pos > offset ? offset : pos;
+}
+
+/* keep the styles in step with an edit, and mark what it changed */
+static void tinyrl_styles_edited(struct tinyrl *this, size_t offset,
+				 size_t removed, size_t inserted)
+{
+	size_t old_len = this->end + removed - inserted;
+
+	if (this->styles_len != old_len
+	    || !tinyrl_reserve(this, &this->styles, &this->styles_size,
+			       this->end + 1)) {
+		/* highlight all of it again */
+		this->styles_len = 0;
+		return;
+	}
+	memmove(this->styles + offset + inserted,
+		this->styles + offset + removed, old_len - offset - removed);
+	memset(this->styles + offset, 0, inserted);
+	this->styles_len = this->end;
+
+	if (this->dirty) {
+		this->dirty_start = tinyrl_edit_pos(this->dirty_start,
+						    offset, removed, inserted);
+		this->dirty_end = tinyrl_edit_pos(this->dirty_end,
+						  offset, removed, inserted);
+		if (offset < this->dirty_start)
+			this->dirty_start = offset;
+		if (offset + inserted > this->dirty_end)
+			this->dirty_end = offset + inserted;
+	} else {
+		this->dirty = true;
+		this->dirty_start = offset;
+		this->dirty_end = offset + inserted;
 	}
 }
 
+/* report a change to the line, which has already been made */
+static void tinyrl_edited(struct tinyrl *this, size_t offset,
+			  size_t removed, size_t inserted)
+{
+	RECORD(this, EDIT, offset, removed, inserted);
+	this->suggest_valid = false;
+	if (this->highlight)
+		tinyrl_styles_edited(this, offset, removed, inserted);
+	if (this->edit_observer)
+		this->edit_observer(this->edit_context, this->line,
+				    offset, removed, inserted);
+}
+
 static bool tinyrl_key_default(void *context, char *key)
 {
 	struct tinyrl *this = context;
@@ -141,6 +576,9 @@ static bool tinyrl_key_interrupt(void *context, char *key)
 {
 	struct tinyrl *this = context;
 
+	/* a recalled line may be too long to copy in and delete from */
+	if (this->line != this->buffer)
+		tinyrl_set_line(this, "");
 	tinyrl_delete_text(this, 0, this->end);
 	this->done = true;
 
@@ -160,6 +598,9 @@ static bool tinyrl_key_end_of_line(void *context, char *key)
 {
 	struct tinyrl *this = context;
 
+	if (this->point == this->end && this->last_suggested)
+		return tinyrl_accept_suggestion(this);
+
 	/* set the insertion point to the end of the line */
 	this->point = this->end;
 	return true;
@@ -169,11 +610,12 @@ static bool tinyrl_key_kill(void *context, char *key)
 {
 	struct tinyrl *this = context;
 
-	/* release any old kill string */
-	free(this->kill_string);
-
-	/* store the killed string */
-	this->kill_string = strdup(&this->buffer[this->point]);
+	/* store the killed string, reusing the memory of any old one */
+	if (!tinyrl_reserve(this, &this->kill_string, &this->kill_size,
+			    this->end - this->point + 1))
+		return false;
+	memcpy(this->kill_string, &this->line[this->point],
+	       this->end - this->point + 1);
 
 	/* delete the text to the end of the line */
 	tinyrl_delete_text(this, this->point, this->end);
@@ -218,6 +660,8 @@ static bool tinyrl_key_right(void *context, char *key)
 	if (this->point < this->end) {
 		this->point = utf8_grapheme_next(this->line, this->end, this->point);
 		result = true;
+	} else {
+		result = tinyrl_accept_suggestion(this);
 	}
 	return result;
 }
@@ -270,89 +714,259 @@ static bool tinyrl_key_erase_line(void *context, char *key)
 	return true;
 }
 
-static struct tinyrl_keymap *tinyrl_keymap_new()
-{
-	struct tinyrl_keymap *keymap;
-	int i;
+/*
+ * The default keymap is shared by every instance, and its handlers are
+ * passed the instance as their context.  An instance only stores the
+ * bindings which have been changed from it.
+ */
+static tinyrl_key_func_t *const tinyrl_default_keymap[KEY_CODES] = {
+	[32 ... 255] = tinyrl_key_default,
+	['\r'] = tinyrl_key_crlf,
+	['\n'] = tinyrl_key_crlf,
+	[CTRL('C')] = tinyrl_key_interrupt,
+	[BACKSPACE] = tinyrl_key_backspace,
+	[CTRL('H')] = tinyrl_key_backspace,
+	[CTRL('D')] = tinyrl_key_delete,
+	[CTRL('L')] = tinyrl_key_clear_screen,
+	[CTRL('U')] = tinyrl_key_erase_line,
+	[CTRL('A')] = tinyrl_key_start_of_line,
+	[CTRL('E')] = tinyrl_key_end_of_line,
+	[CTRL('K')] = tinyrl_key_kill,
+	[CTRL('Y')] = tinyrl_key_yank,
+	[SPECIAL(TINYRL_KEY_RIGHT, 0)] = tinyrl_key_right,
+	[SPECIAL(TINYRL_KEY_LEFT, 0)] = tinyrl_key_left,
+	[SPECIAL(TINYRL_KEY_HOME, 0)] = tinyrl_key_start_of_line,
+	[SPECIAL(TINYRL_KEY_END, 0)] = tinyrl_key_end_of_line,
+	[SPECIAL(TINYRL_KEY_DELETE, 0)] = tinyrl_key_delete,
+};
+
+/*
+ * The special keys, by the final byte of their CSI (ESC [) or SS3 (ESC O)
+ * sequence, less 0x40.  0 is for none, so the keys are stored plus 1.
+ */
+static const unsigned char tinyrl_key_finals[0x40] = {
+	['A' - 0x40] = TINYRL_KEY_UP + 1,
+	['B' - 0x40] = TINYRL_KEY_DOWN + 1,
+	['C' - 0x40] = TINYRL_KEY_RIGHT + 1,
+	['D' - 0x40] = TINYRL_KEY_LEFT + 1,
+	['H' - 0x40] = TINYRL_KEY_HOME + 1,
+	['F' - 0x40] = TINYRL_KEY_END + 1,
+	['P' - 0x40] = TINYRL_KEY_F1 + 1,
+	['Q' - 0x40] = TINYRL_KEY_F2 + 1,
+	['R' - 0x40] = TINYRL_KEY_F3 + 1,
+	['S' - 0x40] = TINYRL_KEY_F4 + 1,
+};
 
-	keymap = malloc(sizeof(*keymap));
+/* and those ending in '~', by their first parameter */
+static const unsigned char tinyrl_key_tildes[25] = {
+	[1] = TINYRL_KEY_HOME + 1,
+	[2] = TINYRL_KEY_INSERT + 1,
+	[3] = TINYRL_KEY_DELETE + 1,
+	[4] = TINYRL_KEY_END + 1,
+	[5] = TINYRL_KEY_PAGE_UP + 1,
+	[6] = TINYRL_KEY_PAGE_DOWN + 1,
+	[7] = TINYRL_KEY_HOME + 1,
+	[8] = TINYRL_KEY_END + 1,
+	[11] = TINYRL_KEY_F1 + 1,
+	[12] = TINYRL_KEY_F2 + 1,
+	[13] = TINYRL_KEY_F3 + 1,
+	[14] = TINYRL_KEY_F4 + 1,
+	[15] = TINYRL_KEY_F5 + 1,
+	[17] = TINYRL_KEY_F6 + 1,
+	[18] = TINYRL_KEY_F7 + 1,
+	[19] = TINYRL_KEY_F8 + 1,
+	[20] = TINYRL_KEY_F9 + 1,
+	[21] = TINYRL_KEY_F10 + 1,
+	[23] = TINYRL_KEY_F11 + 1,
+	[24] = TINYRL_KEY_F12 + 1,
+};
 
-	for (i = 0; i < KEYMAP_SIZE; i++) {
-		keymap->handler[i] = NULL;
-		keymap->keymap[i] = NULL;
-		keymap->context[i] = NULL;
+/* find the index at which the binding for code is, or would be, stored */
+static unsigned tinyrl_find_binding(const struct tinyrl *this, unsigned code)
+{
+	unsigned lo = 0, hi = this->bindings_len, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (this->bindings[mid].code < code)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
+	return lo;
+}
+
+static void tinyrl_lookup_key(struct tinyrl *this, unsigned code,
+			      tinyrl_key_func_t **handler, void **context)
+{
+	unsigned i = tinyrl_find_binding(this, code);
 
-	return keymap;
+	if (i < this->bindings_len && this->bindings[i].code == code) {
+		*handler = this->bindings[i].handler;
+		*context = this->bindings[i].context;
+	} else {
+		*handler = tinyrl_default_keymap[code];
+		*context = this;
+	}
 }
 
-static void tinyrl_keymap_free(struct tinyrl_keymap *keymap)
+static void tinyrl_bind_code(struct tinyrl *this, unsigned code,
+			     tinyrl_key_func_t *handler, void *context)
 {
-	int i;
+	struct tinyrl_binding *bindings;
+	unsigned i = tinyrl_find_binding(this, code);
+	bool found = i < this->bindings_len && this->bindings[i].code == code;
+
+	if (handler == tinyrl_default_keymap[code]
+	    && (context == this || !handler)) {
+		/* back to the default, so the binding isn't needed */
+		if (found) {
+			this->bindings_len--;
+			memmove(&this->bindings[i], &this->bindings[i + 1],
+				(this->bindings_len - i) * sizeof(*bindings));
+		}
+		return;
+	}
 
-	for (i = 0; i < KEYMAP_SIZE; i++)
-		if (keymap->keymap[i])
-			tinyrl_keymap_free(keymap->keymap[i]);
-	free(keymap);
+	if (!found) {
+		if (this->bindings_len == this->bindings_size) {
+			unsigned new_size = this->bindings_size ?
+				this->bindings_size * 2 : 4;
+
+			bindings = tinyrl__realloc(this, this->bindings,
+						   new_size * sizeof(*bindings));
+			if (!bindings)
+				return;
+			this->bindings = bindings;
+			this->bindings_size = new_size;
+		}
+		memmove(&this->bindings[i + 1], &this->bindings[i],
+			(this->bindings_len - i) * sizeof(*bindings));
+		this->bindings_len++;
+		this->bindings[i].code = code;
+	}
+	this->bindings[i].handler = handler;
+	this->bindings[i].context = context;
 }
 
 static void tinyrl_fini(struct tinyrl *this)
 {
 	/* free up any dynamic strings */
-	free(this->buffer);
+	tinyrl__free(this, this->buffer);
 	this->buffer = NULL;
-	free(this->kill_string);
+	tinyrl__free(this, this->kill_string);
 	this->kill_string = NULL;
-	free(this->last_buffer);
-	tinyrl_keymap_free(this->keymap);
+	tinyrl__free(this, this->display);
+	tinyrl__free(this, this->last_buffer);
+	tinyrl__free(this, this->styles);
+	tinyrl__free(this, this->spans);
+	tinyrl__free(this, this->display_styles);
+	tinyrl__free(this, this->last_styles);
+	tinyrl__free(this, this->output);
+	tinyrl__free(this, this->input);
+	tinyrl__free(this, this->bindings);
 }
 
+/*
+ * Set everything but the buffers and key bindings to its initial state.
+ */
 static void
-tinyrl_init(struct tinyrl *this, FILE * instream, FILE * outstream)
-{
-	int i;
-
-	this->keymap = tinyrl_keymap_new();
-	for (i = 32; i < 256; i++)
-		tinyrl_bind_key(this, i, tinyrl_key_default, this);
-	tinyrl_bind_key(this, '\r', tinyrl_key_crlf, this);
-	tinyrl_bind_key(this, '\n', tinyrl_key_crlf, this);
-	tinyrl_bind_key(this, CTRL('C'), tinyrl_key_interrupt, this);
-	tinyrl_bind_key(this, BACKSPACE, tinyrl_key_backspace, this);
-	tinyrl_bind_key(this, CTRL('H'), tinyrl_key_backspace, this);
-	tinyrl_bind_key(this, CTRL('D'), tinyrl_key_delete, this);
-	tinyrl_bind_key(this, CTRL('L'), tinyrl_key_clear_screen, this);
-	tinyrl_bind_key(this, CTRL('U'), tinyrl_key_erase_line, this);
-	tinyrl_bind_key(this, CTRL('A'), tinyrl_key_start_of_line, this);
-	tinyrl_bind_key(this, CTRL('E'), tinyrl_key_end_of_line, this);
-	tinyrl_bind_key(this, CTRL('K'), tinyrl_key_kill, this);
-	tinyrl_bind_key(this, CTRL('Y'), tinyrl_key_yank, this);
-	tinyrl_bind_special(this, TINYRL_KEY_RIGHT, tinyrl_key_right, this);
-	tinyrl_bind_special(this, TINYRL_KEY_LEFT, tinyrl_key_left, this);
-	tinyrl_bind_special(this, TINYRL_KEY_HOME, tinyrl_key_start_of_line, this);
-	tinyrl_bind_special(this, TINYRL_KEY_END, tinyrl_key_end_of_line, this);
-	tinyrl_bind_special(this, TINYRL_KEY_INSERT, NULL, NULL);
-	tinyrl_bind_special(this, TINYRL_KEY_DELETE, tinyrl_key_delete, this);
-
+tinyrl_init_state(struct tinyrl *this, tinyrl_read_func_t *read,
+		  tinyrl_write_func_t *write, void *context)
+{
 	this->line = NULL;
-	this->max_line_length = 0;
+	this->max_line_length = DEFAULT_LINE_LENGTH;
 	this->prompt = NULL;
-	this->buffer = NULL;
-	this->buffer_size = 0;
 	this->done = false;
 	this->point = 0;
 	this->end = 0;
-	this->kill_string = NULL;
 	this->echo_char = '\0';
 	this->echo_enabled = true;
-	this->isatty = isatty(fileno(instream));
-	this->last_buffer = NULL;
+	this->isatty = true;
+	this->last_valid = false;
 	this->last_end = 0;
 	this->last_row = 0;
 	this->last_point_row = 0;
+	this->layout_line = NULL;
+	this->highlight = NULL;
+	this->highlight_context = NULL;
+	memset(this->style_sgr, 0, sizeof(this->style_sgr));
+	this->style_sgr[TINYRL_STYLE_SUGGESTION] = "2";
+	this->styles_len = 0;
+	this->dirty = false;
+	this->display_styled = false;
+	this->last_styled = false;
+	this->suggest = NULL;
+	this->suggest_context = NULL;
+	this->suggestion = NULL;
+	this->suggestion_len = 0;
+	this->suggest_valid = false;
+	this->suggest_hidden = false;
+	this->display_suggested = false;
+	this->last_suggested = false;
+
+	this->istream = NULL;
+	this->ostream = NULL;
+	this->read = read;
+	this->read_context = context;
+	this->input_pos = 0;
+	this->input_len = 0;
+	this->write = write;
+	this->write_context = context;
+	this->output_len = 0;
+	this->reading = false;
+	this->restored = false;
+	this->width = 0;
+	this->raw_mode = false;
+	this->session = false;
+	this->batch_echo = true;
+
+	this->trim_threshold = 0;
+	this->escape_time = 0;
+	this->escape_timeout = DEFAULT_ESCAPE_TIMEOUT;
+	this->post_notify = NULL;
+	this->post_context = NULL;
+	this->edit_observer = NULL;
+	this->edit_context = NULL;
+	this->recorder = NULL;
+	this->usage = NULL;
+#ifdef TINYRL_LATENCY_STATS
+	memset(&this->latency, 0, sizeof(this->latency));
+	this->key_time = 0;
+#endif
+}
 
-	this->istream = instream;
-	this->ostream = outstream;
+static void
+tinyrl_init(struct tinyrl *this, tinyrl_read_func_t *read,
+	    tinyrl_write_func_t *write, void *context)
+{
+	this->buffer = NULL;
+	this->buffer_size = 0;
+	this->kill_string = NULL;
+	this->kill_size = 0;
+	this->display = NULL;
+	this->display_size = 0;
+	this->last_buffer = NULL;
+	this->last_size = 0;
+	this->styles = NULL;
+	this->styles_size = 0;
+	this->spans = NULL;
+	this->spans_size = 0;
+	this->display_styles = NULL;
+	this->display_styles_size = 0;
+	this->last_styles = NULL;
+	this->last_styles_size = 0;
+	this->input = NULL;
+	this->input_size = 0;
+	this->output = NULL;
+	this->output_size = 0;
+	this->bindings = NULL;
+	this->bindings_len = 0;
+	this->bindings_size = 0;
+	this->posted = NULL;
+	this->wake[0] = -1;
+	this->wake[1] = -1;
+	tinyrl_init_state(this, read, write, context);
 }
 
 int tinyrl_printf(struct tinyrl *this, const char *fmt, ...)
@@ -360,31 +974,175 @@ int tinyrl_printf(struct tinyrl *this, const char *fmt, ...)
 	va_list args;
 	int len;
 
+	/* format straight into the output buffer, growing it if required */
+	if (!tinyrl_extend_output(this, 1))
+		return -1;
 	va_start(args, fmt);
-	len = vfprintf(this->ostream, fmt, args);
+	len = vsnprintf(this->output + this->output_len,
+			this->output_size - this->output_len, fmt, args);
 	va_end(args);
+	if (len < 0)
+		return len;
+	if ((size_t)len >= this->output_size - this->output_len) {
+		if (!tinyrl_extend_output(this, len + 1))
+			return -1;
+		va_start(args, fmt);
+		vsnprintf(this->output + this->output_len, len + 1, fmt, args);
+		va_end(args);
+	}
+	this->output_len += len;
+	if (!this->reading)
+		tinyrl_flush(this);
 
 	return len;
 }
 
+/*
+ * Take the posted messages off the queue, returning them oldest first.
+ * Messages are allocated and freed directly through the allocator, as the
+ * counts kept by tinyrl__malloc() belong to the instance's own thread.
+ */
+static struct tinyrl_message *tinyrl_take_posted(struct tinyrl *this)
+{
+	struct tinyrl_message *msg, *next, *list = NULL;
+
+	if (!__atomic_load_n(&this->posted, __ATOMIC_RELAXED))
+		return NULL;
+	msg = __atomic_exchange_n(&this->posted, NULL, __ATOMIC_ACQUIRE);
+	for (; msg; msg = next) {
+		next = msg->next;
+		msg->next = list;
+		list = msg;
+	}
+	return list;
+}
+
+static void tinyrl_discard_posted(struct tinyrl *this)
+{
+	struct tinyrl_message *msg, *next;
+
+	for (msg = tinyrl_take_posted(this); msg; msg = next) {
+		next = msg->next;
+		this->alloc.free(this->alloc.context, msg);
+	}
+}
+
+static void tinyrl_close_wake(struct tinyrl *this)
+{
+	if (this->wake[0] >= 0) {
+		close(this->wake[0]);
+		close(this->wake[1]);
+		this->wake[0] = this->wake[1] = -1;
+	}
+}
+
+void tinyrl_reset(struct tinyrl *this, tinyrl_read_func_t *read,
+		  tinyrl_write_func_t *write, void *context)
+{
+	tinyrl_leave_raw_mode(this);
+	tinyrl_discard_posted(this);
+	tinyrl_close_wake(this);
+
+	/* an empty kill string could be yanked, so there must be none */
+	tinyrl__free(this, this->kill_string);
+	this->kill_string = NULL;
+	this->kill_size = 0;
+	if (this->buffer)
+		this->buffer[0] = '\0';
+	/* the bindings' contexts belong to the last session */
+	this->bindings_len = 0;
+	tinyrl_init_state(this, read, write, context);
+}
+
 void tinyrl_delete(struct tinyrl *this)
 {
 	assert(this);
 	if (this) {
 		/* let the object tidy itself up */
+		tinyrl_leave_raw_mode(this);
+		tinyrl_discard_posted(this);
+		tinyrl_close_wake(this);
 		tinyrl_fini(this);
 
 		/* release the memory associate with this instance */
-		free(this);
+		tinyrl__free(this, this);
+	}
+}
+
+/* tinyrl_getbyte() result when non-blocking and no input is pending */
+#define NO_INPUT (-2)
+
+/*
+ * Read more input from the input source, after any which is still unread.
+ * The result is positive if input was read, 0 if block is false and there
+ * is none pending, and negative at the end of input.
+ */
+static int tinyrl_fill_input(struct tinyrl *this, bool block)
+{
+	int len;
+
+	if (!this->input) {
+		/* non-interactive input is read in much larger blocks */
+		size_t size = this->isatty ? INPUT_SIZE : BATCH_INPUT_SIZE;
+
+		this->input = tinyrl__malloc(this, size);
+		if (!this->input)
+			return -1;
+		this->input_size = size;
+	}
+
+	/* keep the unread input, such as the start of a character */
+	if (this->input_pos) {
+		memmove(this->input, this->input + this->input_pos,
+			this->input_len - this->input_pos);
+		this->input_len -= this->input_pos;
+		this->input_pos = 0;
+	}
+
+	if (block) {
+		len = this->read(this->read_context, this->input + this->input_len,
+				 this->input_size - this->input_len, block);
+		if (len == 0 && !__atomic_load_n(&this->posted, __ATOMIC_ACQUIRE))
+			len = -1;
+	} else {
+		LATENCY_BEGIN(start);
+
+		len = this->read(this->read_context, this->input + this->input_len,
+				 this->input_size - this->input_len, block);
+		LATENCY_END(this, TINYRL_LATENCY_READ, start);
+	}
+	if (len <= 0)
+		return len;
+	this->input_len += len;
+	return len;
+}
+
+/* The result is EOF at the end of input, or NO_INPUT */
+static int tinyrl_getbyte(struct tinyrl *this, bool block)
+{
+	int len;
+
+	if (this->input_pos == this->input_len) {
+		len = tinyrl_fill_input(this, block);
+		if (len <= 0)
+			return len ? EOF : NO_INPUT;
 	}
+	return (unsigned char)this->input[this->input_pos++];
 }
 
-static int tinyrl_getchar(const struct tinyrl *this, char *key)
+/*
+ * Read a character into key.  The result is its length, -1 at the end of
+ * input or for an invalid character, or 0 if block is false and the
+ * character has not yet arrived (it is left in the input buffer).
+ */
+static int tinyrl_getchar(struct tinyrl *this, char *key, bool block)
 {
-	int c;
-	size_t i, key_len;
+	int c, len;
+	size_t key_len;
 
-	c = getc(this->istream);
+	c = tinyrl_getbyte(this, block);
+	if (c == NO_INPUT)
+		return 0;
 	if (c == EOF)
 		return -1;
 
@@ -392,14 +1150,18 @@ static int tinyrl_getchar(const struct tinyrl *this, char *key)
 	if (!key_len)
 		return -1;
 
-	key[0] = c;
-	for (i = 1; i < key_len; i++) {
-		c = getc(this->istream);
-		if (c == EOF)
+	/* wait for the rest of the character */
+	this->input_pos--;
+	while (this->input_len - this->input_pos < key_len) {
+		len = tinyrl_fill_input(this, block);
+		if (len == 0)
+			return 0;
+		if (len < 0)
 			return -1;
-		key[i] = c;
 	}
-	key[i] = 0;
+	memcpy(key, this->input + this->input_pos, key_len);
+	key[key_len] = 0;
+	this->input_pos += key_len;
 
 	if (utf8_char_decode(key, key_len, NULL) != key_len)
 		return -1;
@@ -407,71 +1169,275 @@ static int tinyrl_getchar(const struct tinyrl *this, char *key)
 	return key_len;
 }
 
-static int tinyrl_getchar_nonblock(const struct tinyrl *this, char *key)
+/*
+ * Bring the styles of the line up to date, highlighting the region which
+ * has changed since the last time.  The result is false if the line is not
+ * highlighted.
+ */
+static bool tinyrl_highlight_line(struct tinyrl *this)
 {
-	int fd;
-	int flags;
-	int key_len;
-
-	fd = fileno(this->istream);
-	flags = fcntl(fd, F_GETFL, 0);
-	if (flags != -1)
-		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-	key_len = tinyrl_getchar(this, key);
-	if (flags != -1)
-		fcntl(fd, F_SETFL, flags);
-	return key_len;
+	const char *line = this->line;
+	struct tinyrl_span *spans;
+	size_t start, end, max, n, i, s, e;
+
+	if (!this->highlight)
+		return false;
+	if (this->styles_len != this->end || !this->styles) {
+		/* out of step, so start again */
+		if (!tinyrl_reserve(this, &this->styles, &this->styles_size,
+				    this->end + 1))
+			return false;
+		this->styles_len = this->end;
+		this->dirty = true;
+		this->dirty_start = 0;
+		this->dirty_end = this->end;
+	}
+	if (!this->dirty)
+		return true;
+
+	/* widen the region to whole words */
+	start = this->dirty_start;
+	end = this->dirty_end;
+	while (start && !isspace((unsigned char)line[start - 1]))
+		start--;
+	while (end < this->end && !isspace((unsigned char)line[end]))
+		end++;
+
+	max = this->spans_size / sizeof(*spans);
+	n = this->highlight(this->highlight_context, line, this->end,
+			    &start, &end, (struct tinyrl_span *)this->spans, max);
+	if (n > max) {
+		if (!tinyrl_reserve(this, &this->spans, &this->spans_size,
+				    n * sizeof(*spans)))
+			return false;
+		max = this->spans_size / sizeof(*spans);
+		n = this->highlight(this->highlight_context, line, this->end,
+				    &start, &end,
+				    (struct tinyrl_span *)this->spans, max);
+		if (n > max)
+			n = max;
+	}
+	spans = (struct tinyrl_span *)this->spans;
+
+	if (end > this->end)
+		end = this->end;
+	if (start > end)
+		start = end;
+	memset(this->styles + start, 0, end - start);
+	for (i = 0; i < n; i++) {
+		s = spans[i].start > start ? spans[i].start : start;
+		e = spans[i].end < end ? spans[i].end : end;
+		if (s < e && spans[i].style < TINYRL_STYLES)
+			memset(this->styles + s, spans[i].style, e - s);
+	}
+	this->dirty = false;
+	return true;
 }
 
-static void tinyrl_internal_print(
-	struct tinyrl *this, char **buffer, size_t *point, size_t *end)
+/* whether the display has the same styles as the last one, start to end */
+static bool tinyrl_same_styles(const struct tinyrl *this,
+			       size_t start, size_t end)
 {
-	if (this->echo_enabled) {
-		/* simply echo the line */
-		*point = this->point;
-		*end = this->end;
-		*buffer = strdup(this->line);
-	} else {
-		/* replace the line with echo char if defined */
-		if (this->echo_char) {
-			size_t i;
-
-			*point = 0;
-			*end = 0;
-			for (i = 0; ; i = utf8_grapheme_next(this->line, this->end, i)) {
-				if (i == this->point)
-					*point = *end;
-				if (i >= this->end)
-					break;
-				*end += 1;
-			}
+	char style, last;
+	size_t i;
 
-			*buffer = malloc(*end + 1);
-			if (*buffer) {
-				memset(*buffer, this->echo_char, *end);
-				(*buffer)[*end] = 0;
-			}
-		} else {
-			*point = 0;
-			*end = 0;
-			*buffer = strdup("");
-		}
+	if (!this->display_styled && !this->last_styled)
+		return true;
+	for (i = start; i < end; i++) {
+		style = this->display_styled ? this->display_styles[i] : 0;
+		last = this->last_styled ? this->last_styles[i] : 0;
+		if (style != last)
+			return false;
 	}
+	return true;
 }
 
-static void tinyrl_string_wrap(
-	const char *s, size_t len, size_t row_width, size_t *row, size_t *col)
+/* the style of a byte of the display, 0 if it has no SGR parameters */
+static unsigned tinyrl_display_style(const struct tinyrl *this, size_t i)
 {
-	size_t point, next, width;
+	unsigned style = (unsigned char)this->display_styles[i];
 
-	for (point = 0; point < len; point = next) {
-		width = utf8_grapheme_width(s, len, point, &next);
-		*col += width;
-		if (*col > row_width) {
-			*row += 1;
-			*col = width;
-		}
-	}
+	return this->style_sgr[style] ? style : 0;
+}
+
+/*
+ * Write the display from start to end, changing the style only where a
+ * character starts.  The style is back to the default afterwards.
+ */
+static void tinyrl_write_styled(struct tinyrl *this, size_t start, size_t end)
+{
+	const char *buf = this->display;
+	unsigned style = 0, next;
+	size_t i, run;
+
+	if (!this->display_styled) {
+		tinyrl_write(this, buf + start, end - start);
+		return;
+	}
+	for (i = start; i < end; i = run) {
+		next = tinyrl_display_style(this, i);
+		for (run = i + 1; run < end; run++)
+			if ((buf[run] & 0xc0) != 0x80
+			    && tinyrl_display_style(this, run) != next)
+				break;
+		if (next != style) {
+			if (next)
+				tinyrl_printf(this, "\x1b[0;%sm",
+					      this->style_sgr[next]);
+			else
+				tinyrl_printf(this, "\x1b[0m");
+			style = next;
+		}
+		tinyrl_write(this, buf + i, run - i);
+	}
+	if (style)
+		tinyrl_printf(this, "\x1b[0m");
+}
+
+/*
+ * The suggestion to show after the line, which is only asked for when the
+ * line has changed.  There is none unless the cursor is at the end of the
+ * line.
+ */
+static const char *tinyrl_get_suggestion(struct tinyrl *this, size_t *len)
+{
+	*len = 0;
+	if (!this->suggest || this->suggest_hidden || this->done
+	    || !this->end || this->point != this->end)
+		return NULL;
+	if (!this->suggest_valid) {
+		this->suggestion = this->suggest(this->suggest_context,
+						 this->line, this->end);
+		this->suggestion_len = this->suggestion ?
+			strlen(this->suggestion) : 0;
+		this->suggest_valid = true;
+	}
+	*len = this->suggestion_len;
+	return this->suggestion;
+}
+
+/*
+ * Render the line as it should be displayed into the display buffer.
+ */
+static bool tinyrl_internal_print(
+	struct tinyrl *this, size_t *point, size_t *end)
+{
+	if (this->echo_enabled) {
+		/* simply echo the line */
+		size_t len;
+		const char *suggestion = tinyrl_get_suggestion(this, &len);
+		bool highlighted;
+
+		*point = this->point;
+		*end = this->end;
+		if (!tinyrl_reserve(this, &this->display, &this->display_size,
+				    *end + len + 1))
+			return false;
+		memcpy(this->display, this->line, *end);
+		if (len)
+			memcpy(this->display + *end, suggestion, len);
+		this->display[*end + len] = '\0';
+		if (len && *end
+		    && utf8_grapheme_next(this->display, *end + len,
+					  utf8_grapheme_prev(this->display,
+							     *end + len, *end))
+		    != *end) {
+			/* it would join the line's last grapheme */
+			this->display[*end] = '\0';
+			len = 0;
+		}
+
+		highlighted = tinyrl_highlight_line(this);
+		this->display_styled = (highlighted || len)
+			&& tinyrl_reserve(this, &this->display_styles,
+					  &this->display_styles_size,
+					  *end + len + 1);
+		if (this->display_styled) {
+			if (highlighted)
+				memcpy(this->display_styles, this->styles, *end);
+			else
+				memset(this->display_styles, 0, *end);
+			memset(this->display_styles + *end,
+			       TINYRL_STYLE_SUGGESTION, len);
+		} else if (len) {
+			/* a suggestion must look like one */
+			this->display[*end] = '\0';
+			len = 0;
+		}
+		this->display_suggested = len;
+		*end += len;
+	} else {
+		this->display_suggested = false;
+		this->display_styled = false;
+		/* replace the line with echo char if defined */
+		if (this->echo_char) {
+			size_t i;
+
+			*point = 0;
+			*end = 0;
+			if (this->line == this->layout_line
+			    && this->point == this->end) {
+				/* one echo char per grapheme */
+				*point = *end = this->layout.graphemes;
+			} else {
+				for (i = 0; ; i = utf8_grapheme_next(this->line, this->end, i)) {
+					if (i == this->point)
+						*point = *end;
+					if (i >= this->end)
+						break;
+					*end += 1;
+				}
+			}
+
+			if (!tinyrl_reserve(this, &this->display,
+					    &this->display_size, *end + 1))
+				return false;
+			memset(this->display, this->echo_char, *end);
+			this->display[*end] = 0;
+		} else {
+			*point = 0;
+			*end = 0;
+			if (!tinyrl_reserve(this, &this->display,
+					    &this->display_size, 1))
+				return false;
+			this->display[0] = 0;
+		}
+	}
+	return true;
+}
+
+static void tinyrl_string_wrap(
+	const char *s, size_t len, size_t row_width, size_t *row, size_t *col)
+{
+	size_t point, next, width;
+
+	for (point = 0; point < len; point = next) {
+		width = utf8_grapheme_width(s, len, point, &next);
+		*col += width;
+		if (*col > row_width) {
+			*row += 1;
+			*col = width;
+		}
+	}
+}
+
+/* tinyrl_string_wrap() for a measured line, without scanning it if possible */
+static void tinyrl_layout_wrap(const struct tinyrl_line_layout *layout,
+			       const char *s, size_t row_width,
+			       size_t *row, size_t *col)
+{
+	size_t total = *col + layout->width;
+
+	if (total <= row_width) {
+		/* it all fits on the row */
+		*col = total;
+	} else if (layout->narrow && row_width) {
+		/* a column at a time, so only the last wraps part way */
+		*row += (total - 1) / row_width;
+		*col = (total - 1) % row_width + 1;
+	} else {
+		tinyrl_string_wrap(s, layout->len, row_width, row, col);
+	}
 }
 
 void tinyrl_redisplay(struct tinyrl *this)
@@ -484,6 +1450,10 @@ void tinyrl_redisplay(struct tinyrl *this)
 	size_t next_len, keep_len, keep_row, keep_col;
 	size_t point, end;
 	char *buffer;
+	size_t buffer_size;
+	size_t erased = 0;
+	bool full = !this->last_valid;
+	LATENCY_BEGIN(start);
 
 	width = tinyrl__get_width(this);
 
@@ -491,12 +1461,12 @@ void tinyrl_redisplay(struct tinyrl *this)
 	prompt_col = 0;
 	tinyrl_string_wrap(this->prompt, strlen(this->prompt), width, &prompt_row, &prompt_col);
 
-	tinyrl_internal_print(this, &buffer, &point, &end);
-	if (!buffer)
+	if (!tinyrl_internal_print(this, &point, &end))
 		return;
+	buffer = this->display;
 
 	/* erase changed portion of previous line */
-	if (this->last_buffer) {
+	if (this->last_valid) {
 		/* find out how much to keep */
 		keep_len = 0;
 		for (;;) {
@@ -507,6 +1477,11 @@ void tinyrl_redisplay(struct tinyrl *this)
 				break;
 			if (memcmp(buffer + keep_len, this->last_buffer + keep_len, next_len - keep_len) != 0)
 				break;
+			if (!tinyrl_same_styles(this, keep_len, next_len))
+				break;
+			/* the old grapheme may have had more combining marks */
+			if (utf8_grapheme_next(this->last_buffer, this->last_end, keep_len) != next_len)
+				break;
 			keep_len = next_len;
 		}
 
@@ -534,6 +1509,7 @@ void tinyrl_redisplay(struct tinyrl *this)
 		for (i = keep_row; i < this->last_row; i++) {
 			tinyrl_vt100_erase_line(this);
 			tinyrl_vt100_cursor_up(this, 1);
+			erased++;
 		}
 
 		/* partially erase the last kept row */
@@ -542,19 +1518,29 @@ void tinyrl_redisplay(struct tinyrl *this)
 		tinyrl_vt100_erase_line_end(this);
 	} else {
 		keep_len = 0;
-		tinyrl_printf(this, "%s", this->prompt);
+		tinyrl_write(this, this->prompt, strlen(this->prompt));
 	}
 
-	tinyrl_printf(this, "%s", buffer + keep_len);
+	tinyrl_write_styled(this, keep_len, end);
 
 	/* move cursor to point */
 	row = prompt_row;
 	col = prompt_col;
-	tinyrl_string_wrap(buffer, end, width, &row, &col);
-
-	point_row = prompt_row;
-	point_col = prompt_col;
-	tinyrl_string_wrap(buffer, point, width, &point_row, &point_col);
+	if (this->line == this->layout_line && this->echo_enabled
+	    && !this->display_suggested)
+		tinyrl_layout_wrap(&this->layout, buffer, width,
+				   &row, &col);
+	else
+		tinyrl_string_wrap(buffer, end, width, &row, &col);
+
+	if (point == end) {
+		point_row = row;
+		point_col = col;
+	} else {
+		point_row = prompt_row;
+		point_col = prompt_col;
+		tinyrl_string_wrap(buffer, point, width, &point_row, &point_col);
+	}
 	if (point_col == width
 	    || (point < end && point_col + utf8_grapheme_width(buffer, end, point, NULL) > width)) {
 		point_row++;
@@ -577,198 +1563,631 @@ void tinyrl_redisplay(struct tinyrl *this)
 		}
 	}
 
-	free(this->last_buffer);
+	/* swap the display buffers, so neither needs reallocating */
+	this->display = this->last_buffer;
 	this->last_buffer = buffer;
+	buffer_size = this->display_size;
+	this->display_size = this->last_size;
+	this->last_size = buffer_size;
+	buffer = this->display_styles;
+	this->display_styles = this->last_styles;
+	this->last_styles = buffer;
+	buffer_size = this->display_styles_size;
+	this->display_styles_size = this->last_styles_size;
+	this->last_styles_size = buffer_size;
+	this->last_styled = this->display_styled;
+	this->last_suggested = this->display_suggested;
+	this->last_valid = true;
 	this->last_end = end;
 	this->last_row = row;
 	this->last_point_row = point_row;
+	LATENCY_END(this, TINYRL_LATENCY_REDISPLAY, start);
+	RECORD(this, REDISPLAY, keep_len, erased, full);
 
-	fflush(this->ostream);
+	tinyrl_flush(this);
 }
 
-struct tinyrl *tinyrl_new(FILE * instream, FILE * outstream)
+struct tinyrl *tinyrl_new_alloc(const struct tinyrl_allocator *alloc,
+				tinyrl_read_func_t *read,
+				tinyrl_write_func_t *write, void *context)
 {
 	struct tinyrl *this = NULL;
 
-	this = malloc(sizeof(*this));
+	if (!alloc) {
+#ifdef TINYRL_STATIC_MEMORY
+		return NULL;
+#else
+		alloc = &tinyrl_libc_allocator;
+#endif
+	}
+
+	this = alloc->malloc(alloc->context, sizeof(*this));
 	if (NULL != this) {
-		tinyrl_init(this, instream, outstream);
+		this->alloc = *alloc;
+		this->allocs = 1;
+		this->frees = 0;
+		tinyrl_init(this, read, write, context);
 	}
 
 	return this;
 }
 
-/* Call the handler for the longest matching key sequence.
- * Note: if there is a partial match, then the extra keys are discarded.  This
- * shouldn't matter in practice.
- */
-static void tinyrl_handle_key(struct tinyrl *this, char *key, int key_len)
+static struct tinyrl *tinyrl_new_stdio(const struct tinyrl_allocator *alloc,
+				       FILE * instream,
+				       tinyrl_write_func_t *write, void *context)
 {
-	struct tinyrl_keymap *keymap;
-	tinyrl_key_func_t *handler;
-	void *context;
-	unsigned char c;
-	int i;
+	struct tinyrl *this;
 
-	handler = NULL;
-	context = NULL;
-	keymap = this->keymap;
-	i = 0;
-	for (;;) {
-		c = key[i];
-		if (keymap->handler[c]) {
-			handler = keymap->handler[c];
-			context = keymap->context[c];
+	this = tinyrl_new_alloc(alloc, tinyrl_stdio_read, write, context);
+	if (NULL != this) {
+		this->read_context = this;
+		this->istream = instream;
+		/* input is read from the descriptor, so stdio mustn't buffer it */
+		if (fileno(instream) >= 0)
+			setvbuf(instream, NULL, _IONBF, 0);
+		this->isatty = isatty(fileno(instream));
+		if (this->isatty && pipe(this->wake) == 0) {
+			fcntl(this->wake[0], F_SETFL, O_NONBLOCK);
+			fcntl(this->wake[1], F_SETFL, O_NONBLOCK);
+		} else {
+			this->wake[0] = this->wake[1] = -1;
+		}
+		if (write == tinyrl_stdio_write)
+			this->ostream = context;
+	}
+
+	return this;
+}
+
+struct tinyrl *tinyrl_new_static(void *mem, size_t size,
+				 FILE * instream, FILE * outstream)
+{
+	struct tinyrl_allocator alloc;
+
+	if (!tinyrl_mempool_init(&alloc, mem, size))
+		return NULL;
+	return tinyrl_new_stdio(&alloc, instream, tinyrl_stdio_write, outstream);
+}
+
+#ifndef TINYRL_STATIC_MEMORY
+struct tinyrl *tinyrl_new_io(tinyrl_read_func_t *read,
+			     tinyrl_write_func_t *write, void *context)
+{
+	return tinyrl_new_alloc(NULL, read, write, context);
+}
+
+struct tinyrl *tinyrl_new_sink(FILE * instream,
+			       tinyrl_write_func_t *write, void *context)
+{
+	return tinyrl_new_stdio(NULL, instream, write, context);
+}
+
+struct tinyrl *tinyrl_new(FILE * instream, FILE * outstream)
+{
+	return tinyrl_new_stdio(NULL, instream, tinyrl_stdio_write, outstream);
+}
+#endif
+
+/* the longest escape sequence which is matched, longer ones are discarded */
+#define MAX_SEQUENCE 32
+
+/*
+ * Match the escape sequence at the start of the unread input, setting code
+ * to the special key it is for.  CSI (ESC [) and SS3 (ESC O) sequences are
+ * decoded by their parameters and final byte, so that any of them is
+ * recognised, with its modifiers, without a table of sequences to search.
+ * code is KEY_CODES for one which is not known.  Nothing is consumed: the
+ * result is the length of the sequence, 1 if the ESC does not start one
+ * (so the bytes after it are left to be read as keys of their own), or 0
+ * if more input is needed to tell.
+ */
+static size_t tinyrl_match_sequence(const struct tinyrl *this, unsigned *code)
+{
+	const unsigned char *p = (const unsigned char *)this->input
+		+ this->input_pos;
+	size_t avail = this->input_len - this->input_pos;
+	unsigned params[2] = { 0, 0 }, nparams = 0;
+	unsigned key = 0, modifiers = 0;
+	size_t len;
+	int c = 0;
+
+	*code = ESCAPE;
+	if (avail < 2)
+		return 0;
+	if (p[1] != '[' && p[1] != 'O')
+		return 1;
+
+	/* parameters, then a final byte */
+	for (len = 2;; len++) {
+		if (len == MAX_SEQUENCE) {
+			*code = KEY_CODES;
+			return len;
 		}
-		keymap = keymap->keymap[c];
-		if (!keymap)
+		if (len == avail)
+			return 0;
+		c = p[len];
+		if (c >= '0' && c <= '9') {
+			if (!nparams)
+				nparams = 1;
+			if (nparams <= 2 && params[nparams - 1] < 1000)
+				params[nparams - 1] = params[nparams - 1] * 10 + c - '0';
+		} else if (c == ';') {
+			nparams++;
+		} else if (c >= 0x40 && c <= 0x7e) {
 			break;
+		} else if (c < 0x20 || c > 0x3f) {
+			/* not a sequence after all */
+			return 1;
+		}
+	}
 
-		i++;
-		if (i >= key_len) {
-			key_len = tinyrl_getchar_nonblock(this, key);
-			if (key_len <= 0)
-				break;
-			i = 0;
+	*code = KEY_CODES;
+	if (c == '~')
+		key = params[0] < sizeof(tinyrl_key_tildes) ?
+			tinyrl_key_tildes[params[0]] : 0;
+	else
+		key = tinyrl_key_finals[c - 0x40];
+	if (key) {
+		/* xterm sends modifiers as 1 plus a bit mask */
+		if (nparams >= 2 && params[1] > 1)
+			modifiers = (params[1] - 1) % KEY_MODIFIERS;
+		*code = SPECIAL(key - 1, modifiers);
+	}
+	return len + 1;
+}
+
+/*
+ * Wait up to ms milliseconds for more input.  A terminal is polled, and
+ * any other input source is tried again after a millisecond.
+ */
+static void tinyrl_wait_input(struct tinyrl *this, unsigned ms)
+{
+	struct pollfd fds = { .fd = -1, .events = POLLIN };
+	struct timespec ts = { 0, 1000000 };
+
+	if (this->read == tinyrl_stdio_read && this->istream)
+		fds.fd = fileno(this->istream);
+	if (fds.fd >= 0)
+		poll(&fds, 1, ms);
+	else if (ms)
+		nanosleep(&ts, NULL);
+}
+
+/*
+ * Read the escape sequence starting at the ESC which is next in the input
+ * into seq, setting code to its key.  A sequence which arrives in pieces
+ * is waited for, up to the escape timeout from when the ESC arrived, after
+ * which the ESC is taken as a key by itself.  The result is the length,
+ * truncated to fit seq, or 0 if block is false and it is still too soon
+ * to tell (the input is left unread until the next call).
+ */
+static int tinyrl_read_sequence(struct tinyrl *this, char *seq, size_t size,
+				unsigned *code, bool block)
+{
+	uint64_t deadline, now;
+	size_t len;
+	int n;
+
+	if (!this->escape_time)
+		this->escape_time = tinyrl_clock();
+	deadline = this->escape_time + this->escape_timeout * 1000000ULL;
+	while (!(len = tinyrl_match_sequence(this, code))) {
+		n = tinyrl_fill_input(this, false);
+		if (n > 0)
+			continue;
+		now = tinyrl_clock();
+		if (n == 0 && now < deadline) {
+			if (!block)
+				return 0;
+			tinyrl_wait_input(this,
+					  (deadline - now + 999999) / 1000000);
+			continue;
+		}
+		/* the time is up, or the input has ended */
+		*code = ESCAPE;
+		len = 1;
+		break;
+	}
+	this->escape_time = 0;
+
+	n = len < size ? len : size - 1;
+	memcpy(seq, this->input + this->input_pos, n);
+	seq[n] = '\0';
+	this->input_pos += len;
+	return n;
+}
+
+/*
+ * Read a key into key, which is either a character or an escape sequence,
+ * setting code to the key code it is bound by.  The result is as for
+ * tinyrl_getchar().
+ */
+static int tinyrl_getkey(struct tinyrl *this, char *key, size_t size,
+			 unsigned *code, bool block)
+{
+	int key_len;
+
+	if (this->escape_time) {
+		/* still waiting for the rest of a sequence */
+		return tinyrl_read_sequence(this, key, size, code, block);
+	}
+	key_len = tinyrl_getchar(this, key, block);
+	if (key_len <= 0)
+		return key_len;
+	*code = (unsigned char)key[0];
+	if (*code != ESCAPE)
+		return key_len;
+
+	/* the ESC is matched again along with what follows it */
+	this->input_pos--;
+	return tinyrl_read_sequence(this, key, size, code, block);
+}
+
+/* Call the handler for a key */
+static void tinyrl_handle_key(struct tinyrl *this, char *key, int key_len,
+			      unsigned code)
+{
+	tinyrl_key_func_t *handler = NULL;
+	void *context;
+	bool ok = false;
+
+	if (this->recorder)
+		tinyrl_recorder_add_key(this->recorder, key, key_len);
+
+	if (code < KEY_CODES) {
+		tinyrl_lookup_key(this, code, &handler, &context);
+		if (!handler && code >= KEY_SPECIAL
+		    && (code - KEY_SPECIAL) % KEY_MODIFIERS) {
+			/* a modified key does what it does alone by default */
+			code -= (code - KEY_SPECIAL) % KEY_MODIFIERS;
+			tinyrl_lookup_key(this, code, &handler, &context);
 		}
 	}
+	if (handler) {
+		LATENCY_BEGIN(start);
 
-	if (!handler || !handler(context, key)) {
+		ok = handler(context, key);
+		LATENCY_END(this, TINYRL_LATENCY_HANDLER, start);
+	}
+	RECORD(this, HANDLER, code, ok, 0);
+	if (!ok) {
 		/* an issue has occured */
 		tinyrl_ding(this);
 	}
 }
 
-static void tinyrl_readtty(struct tinyrl *this)
+/*
+ * Read and handle a key.  The result is false if block is false and no
+ * complete key has arrived yet.
+ */
+static bool tinyrl_process_key(struct tinyrl *this, bool block)
 {
-	struct termios default_termios;
-	char key[5];
+	char key[16];
+	unsigned code;
 	int key_len;
 
-	tty_set_raw_mode(this->istream, &default_termios);
+	/* get a key */
+	key_len = tinyrl_getkey(this, key, sizeof(key), &code, block);
+	if (key_len == 0)
+		return false;
+
+	/* has the input stream terminated? */
+	if (key_len > 0) {
+		LATENCY_KEY_BEGIN(this);
+
+		/* call the handler for this key */
+		LATENCY_BEGIN(start);
+		tinyrl_handle_key(this, key, key_len, code);
+		LATENCY_END(this, TINYRL_LATENCY_DISPATCH, start);
+
+		if (this->done) {
+			/*
+			 * A recalled line too long for the buffer can't be
+			 * accepted, so carry on editing it (the failed copy
+			 * has dinged).
+			 */
+			if (this->line && !changed_line(this)) {
+				this->done = false;
+				tinyrl_reset_line_state(this);
+				return true;
+			}
+			/*
+			 * If the last character in the line (other than 
+			 * the null) is a space remove it.
+			 */
+			if (this->end
+			    && isspace(this-> line[this->end - 1])) {
+				tinyrl_delete_text(this, this->end - 1,
+						   this->end);
+			}
+		}
+	} else {
+		/* time to finish the session */
+		this->done = true;
+		this->line = NULL;
+	}
+	return true;
+}
+
+static void tinyrl_readtty(struct tinyrl *this)
+{
+	tinyrl_enter_raw_mode(this);
 
 	tinyrl_reset_line_state(this);
 
 	while (!this->done) {
 		/* update the display */
 		tinyrl_redisplay(this);
+		LATENCY_KEY_END(this);
 
-		/* get a key */
-		key_len = tinyrl_getchar(this, key);
-
-		/* has the input stream terminated? */
-		if (key_len > 0) {
-			/* call the handler for this key */
-			tinyrl_handle_key(this, key, key_len);
-
-			if (this->done) {
-				/*
-				 * If the last character in the line (other than 
-				 * the null) is a space remove it.
-				 */
-				if (this->end
-				    && isspace(this-> line[this->end - 1])) {
-					tinyrl_delete_text(this, this->end - 1,
-							   this->end);
-				}
-			}
-		} else {
-			/* time to finish the session */
-			this->done = true;
-			this->line = NULL;
-		}
+		/* messages posted while waiting for a key go above the line */
+		while (!tinyrl_process_key(this, true))
+			tinyrl_print_posted(this);
 	}
 
-	tty_restore_mode(this->istream, &default_termios);
+	if (!this->session)
+		tinyrl_leave_raw_mode(this);
 }
 
 static void tinyrl_readraw(struct tinyrl *this)
 {
 	/* This is a non-interactive set of commands */
-	char *s = 0, buffer[80];
-	size_t len = sizeof(buffer);
+	bool newline = false;
+	bool skip = false;
+	bool any = false;
+	const char *start, *p;
+	size_t len;
+	int n;
 
 	/* manually reset the line state without redisplaying */
-	free(this->last_buffer);
-	this->last_buffer = NULL;
+	this->last_valid = false;
 
-	while ((sizeof(buffer) == len) &&
-	       (s = fgets(buffer, sizeof(buffer), this->istream))) {
-		char *p;
-		/* strip any spurious '\r' or '\n' */
-		p = strchr(buffer, '\r');
-		if (NULL == p) {
-			p = strchr(buffer, '\n');
+	/* append the line a buffered block at a time */
+	for (;;) {
+		if (this->input_pos == this->input_len) {
+			n = tinyrl_fill_input(this, true);
+			if (n == 0) {
+				tinyrl_print_posted(this);
+				continue;
+			}
+			if (n < 0)
+				break;
 		}
-		if (NULL != p) {
-			*p = '\0';
+		any = true;
+
+		start = this->input + this->input_pos;
+		len = this->input_len - this->input_pos;
+		p = memchr(start, '\n', len);
+		if (p) {
+			newline = true;
+			len = p - start;
+			this->input_pos++;
 		}
-		/* skip any whitespace at the beginning of the line */
-		if (0 == this->point) {
-			while (*s && isspace(*s)) {
-				s++;
+		this->input_pos += len;
+
+		if (!skip) {
+			/* strip anything after a spurious '\r' */
+			p = memchr(start, '\r', len);
+			if (p) {
+				skip = true;
+				len = p - start;
 			}
+			/* skip any whitespace at the beginning of the line */
+			if (0 == this->end) {
+				while (len && isspace((unsigned char)*start)) {
+					start++;
+					len--;
+				}
+			}
+			if (len)
+				(void)tinyrl_insert_text_len(this, start, len);
 		}
-		if (*s) {
-			/* append this string to the input buffer */
-			(void)tinyrl_insert_text(this, s);
-			/* echo the command to the output stream */
-			tinyrl_redisplay(this);
-		}
-		len = strlen(buffer) + 1;	/* account for the '\0' */
+
+		if (newline)
+			break;
+	}
+
+	if (this->end && this->batch_echo) {
+		/* echo the command to the output stream */
+		tinyrl_redisplay(this);
 	}
 
 	/*
-	 * check against fgets returning null as either error or end of file.
-	 * This is a measure to stop potential task spin on encountering an
-	 * error from fgets.
+	 * The session is finished once the input stream ends without a
+	 * command on the current line.
 	 */
-	if (s == NULL || (this->line[0] == '\0' && feof(this->istream))) {
+	if (!any || (!newline && this->line[0] == '\0')) {
 		/* time to finish the session */
 		this->line = NULL;
 	} else {
-		tinyrl_crlf(this);
+		if (this->batch_echo)
+			tinyrl_crlf(this);
 		this->done = true;
 	}
 }
 
-char *tinyrl_readline(struct tinyrl *this, const char *prompt)
+/*
+ * Release any scratch buffers holding more than limit bytes.  None of
+ * them carry anything over from one line to the next.
+ */
+static void tinyrl_release(struct tinyrl *this, char **buf, size_t *size,
+			   size_t limit)
+{
+	if (*size > limit) {
+		tinyrl__free(this, *buf);
+		*buf = NULL;
+		*size = 0;
+	}
+}
+
+static void tinyrl_trim_buffers(struct tinyrl *this, size_t limit)
 {
-	char *result;
+	size_t len;
+	char *kill_string;
+
+	tinyrl_release(this, &this->display, &this->display_size, limit);
+	tinyrl_release(this, &this->last_buffer, &this->last_size, limit);
+	tinyrl_release(this, &this->display_styles,
+		       &this->display_styles_size, limit);
+	tinyrl_release(this, &this->last_styles, &this->last_styles_size, limit);
+	tinyrl_release(this, &this->styles, &this->styles_size, limit);
+	if (!this->styles)
+		this->styles_len = 0;
+	tinyrl_release(this, &this->spans, &this->spans_size, limit);
+	this->last_valid = false;
+	if (!this->output_len)
+		tinyrl_release(this, &this->output, &this->output_size, limit);
+	if (this->input_pos == this->input_len)
+		tinyrl_release(this, &this->input, &this->input_size, limit);
+
+	/* the kill string has to be kept, but can be shrunk to fit */
+	if (this->kill_string) {
+		len = strlen(this->kill_string) + 1;
+		if (this->kill_size > limit && this->kill_size > len) {
+			kill_string = tinyrl__realloc(this, this->kill_string, len);
+			if (kill_string) {
+				this->kill_string = kill_string;
+				this->kill_size = len;
+			}
+		}
+	}
+}
 
-	/* initialise for reading a line */
+/* initialise for reading a line, reusing the last line's buffer */
+static bool tinyrl_line_init(struct tinyrl *this, const char *prompt)
+{
+	unsigned old_end;
+
+	tinyrl_print_posted(this);
+	this->suggest_valid = false;
+	if (this->restored && this->buffer) {
+		/* tinyrl_restore() has filled in the line */
+		this->restored = false;
+		this->done = false;
+		this->line = this->buffer;
+		this->prompt = prompt;
+		this->reading = true;
+		return true;
+	}
+	this->restored = false;
+	if (this->buffer && this->trim_threshold
+	    && this->buffer_size + 1 > this->trim_threshold) {
+		tinyrl__free(this, this->buffer);
+		this->buffer = NULL;
+	}
+	if (!this->buffer) {
+		this->buffer = tinyrl__malloc(this, 1);
+		if (!this->buffer)
+			return false;
+		this->buffer_size = 0;
+	}
+	this->buffer[0] = '\0';
 	this->done = false;
 	this->point = 0;
+	old_end = this->end;
 	this->end = 0;
-	this->buffer = strdup("");
-	this->buffer_size = strlen(this->buffer);
 	this->line = this->buffer;
+	if (old_end)
+		tinyrl_edited(this, 0, old_end, 0);
 	this->prompt = prompt;
+	this->reading = true;
+	return true;
+}
+
+static const char *tinyrl_line_finish(struct tinyrl *this, size_t *len)
+{
+	const char *result;
+
+	/*
+	 * we may be referencing a history entry, which could be freed
+	 * before the next call, so move it into our internal buffer
+	 */
+	result = NULL;
+	if (this->line && changed_line(this)) {
+		result = this->buffer;
+		if (len)
+			*len = this->end;
+	}
+
+	if (((NULL == result) || '\0' == *result)
+	    && (this->isatty || this->batch_echo)) {
+		/* make sure we're not left on a prompt line */
+		tinyrl_crlf(this);
+	}
+	this->reading = false;
+	tinyrl_flush(this);
+	LATENCY_KEY_END(this);
+	if (this->trim_threshold)
+		tinyrl_trim_buffers(this, this->trim_threshold);
+	return result;
+}
+
+const char *tinyrl_readline_ref(struct tinyrl *this, const char *prompt,
+				size_t *len)
+{
+	if (!tinyrl_line_init(this, prompt))
+		return NULL;
 
 	if (this->isatty) {
 		tinyrl_readtty(this);
 	} else {
 		tinyrl_readraw(this);
 	}
+	return tinyrl_line_finish(this, len);
+}
 
-	/*
-	 * duplicate the string for return to the client 
-	 * we have to duplicate as we may be referencing a
-	 * history entry or our internal buffer
-	 */
-	result = this->line ? strdup(this->line) : NULL;
+bool tinyrl_line_begin(struct tinyrl *this, const char *prompt)
+{
+	if (!tinyrl_line_init(this, prompt))
+		return false;
+	tinyrl_enter_raw_mode(this);
+	tinyrl_reset_line_state(this);
+	return true;
+}
 
-	/* free our internal buffer */
-	free(this->buffer);
-	this->buffer = NULL;
+bool tinyrl_line_process(struct tinyrl *this, const char **line, size_t *len)
+{
+	if (!this->reading)
+		return false;
 
-	if ((NULL == result) || '\0' == *result) {
-		/* make sure we're not left on a prompt line */
-		tinyrl_crlf(this);
+	tinyrl_print_posted(this);
+	while (!this->done) {
+		if (!tinyrl_process_key(this, false))
+			return false;
+		if (!this->done) {
+			tinyrl_redisplay(this);
+			LATENCY_KEY_END(this);
+		}
 	}
-	return result;
+
+	if (!this->session)
+		tinyrl_leave_raw_mode(this);
+	*line = tinyrl_line_finish(this, len);
+	return true;
 }
 
+int tinyrl_line_timeout(const struct tinyrl *this)
+{
+	uint64_t deadline, now;
+
+	if (!this->reading || !this->escape_time)
+		return -1;
+	deadline = this->escape_time + this->escape_timeout * 1000000ULL;
+	now = tinyrl_clock();
+	return now < deadline ? (deadline - now + 999999) / 1000000 : 0;
+}
+
+#ifndef TINYRL_STATIC_MEMORY
+char *tinyrl_readline(struct tinyrl *this, const char *prompt)
+{
+	const char *line;
+
+	/* duplicate the string for return to the client */
+	line = tinyrl_readline_ref(this, prompt, NULL);
+	return line ? strdup(line) : NULL;
+}
+#endif
+
 /*
  * Ensure that buffer has enough space to hold len characters,
  * possibly reallocating it if necessary. The function returns true
@@ -787,12 +2206,13 @@ static bool tinyrl_extend_line_buffer(struct tinyrl *this, unsigned len)
 		 */
 
 		if (this->max_line_length == 0) {
-			if (new_len < this->buffer_size + 10) {
-				/* make sure we don't realloc too often */
-				new_len = this->buffer_size + 10;
+			if (new_len < this->buffer_size * 2 + 10) {
+				/* grow geometrically so we don't realloc too often */
+				new_len = this->buffer_size * 2 + 10;
 			}
 			/* leave space for terminator */
-			new_buffer = realloc(this->buffer, new_len + 1);
+			new_buffer = tinyrl__realloc(this, this->buffer,
+						     new_len + 1);
 
 			if (NULL == new_buffer) {
 				tinyrl_ding(this);
@@ -807,8 +2227,8 @@ static bool tinyrl_extend_line_buffer(struct tinyrl *this, unsigned len)
 
 				/* Just reallocate once to the max size */
 				new_buffer =
-					realloc(this->buffer,
-						this->max_line_length);
+					tinyrl__realloc(this, this->buffer,
+							this->max_line_length);
 
 				if (NULL == new_buffer) {
 					tinyrl_ding(this);
@@ -837,7 +2257,8 @@ bool tinyrl_insert_text_len(struct tinyrl *this, const char *text, unsigned delt
 	 * If the client wants to change the line ensure that the line and buffer
 	 * references are in sync
 	 */
-	changed_line(this);
+	if (!changed_line(this))
+		return false;
 
 	if ((delta + this->end) > (this->buffer_size)) {
 		/* extend the current buffer */
@@ -857,12 +2278,13 @@ bool tinyrl_insert_text_len(struct tinyrl *this, const char *text, unsigned delt
 	}
 
 	/* insert the new text */
-	strncpy(&this->buffer[this->point], text, delta);
+	memcpy(&this->buffer[this->point], text, delta);
 
 	/* now update the indexes */
 	this->point += delta;
 	this->end += delta;
 
+	tinyrl_edited(this, this->point - delta, 0, delta);
 	return true;
 }
 
@@ -882,13 +2304,15 @@ void tinyrl_delete_text(struct tinyrl *this, unsigned start, unsigned end)
 	if (end == start)
 		return;
 
-	changed_line(this);
+	if (!changed_line(this))
+		return;
 
 	/* move any text which is left, including terminator */
 	delta = end - start;
 	memmove(&this->buffer[start],
 		&this->buffer[start + delta], this->end + 1 - end);
 	this->end -= delta;
+	tinyrl_edited(this, start, delta, 0);
 
 	/* now adjust the indexs */
 	if (this->point > end) {
@@ -900,69 +2324,46 @@ void tinyrl_delete_text(struct tinyrl *this, unsigned start, unsigned end)
 	}
 }
 
-static void tinyrl_bind_keyseq(struct tinyrl *this, const char *seq,
-			       tinyrl_key_func_t *handler, void *context)
+void tinyrl_bind_special(struct tinyrl *this, enum tinyrl_key key,
+			 tinyrl_key_func_t *handler, void *context)
 {
-	struct tinyrl_keymap *keymap;
-	unsigned char key;
-
-	if (!*seq)
-		return;
-
-	keymap = this->keymap;
-	key = *seq++;
+	tinyrl_bind_code(this, SPECIAL(key, 0), handler, context);
+}
 
-	while (*seq) {
-		if (!keymap->keymap[key])
-			keymap->keymap[key] = tinyrl_keymap_new();
-		keymap = keymap->keymap[key];
-		key = *seq++;
-	}
+void tinyrl_unbind_special(struct tinyrl *this, enum tinyrl_key key,
+			   tinyrl_key_func_t *handler, void *context)
+{
+	unsigned code = SPECIAL(key, 0);
+	unsigned i = tinyrl_find_binding(this, code);
 
-	keymap->handler[key] = handler;
-	keymap->context[key] = context;
+	if (i < this->bindings_len && this->bindings[i].code == code
+	    && this->bindings[i].handler == handler
+	    && this->bindings[i].context == context)
+		tinyrl_bind_code(this, code, tinyrl_default_keymap[code], this);
 }
 
-void tinyrl_bind_special(struct tinyrl *this, enum tinyrl_key key,
-			 tinyrl_key_func_t *handler, void *context)
+void tinyrl_bind_special_mod(struct tinyrl *this, enum tinyrl_key key,
+			     unsigned modifiers,
+			     tinyrl_key_func_t *handler, void *context)
 {
-	switch (key) {
-	case TINYRL_KEY_UP:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[A", handler, context);
-		break;
-	case TINYRL_KEY_DOWN:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[B", handler, context);
-		break;
-	case TINYRL_KEY_LEFT:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[D", handler, context);
-		break;
-	case TINYRL_KEY_RIGHT:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[C", handler, context);
-		break;
-	case TINYRL_KEY_HOME:
-		tinyrl_bind_keyseq(this, ESCAPESTR "OH", handler, context);
-		break;
-	case TINYRL_KEY_END:
-		tinyrl_bind_keyseq(this, ESCAPESTR "OF", handler, context);
-		break;
-	case TINYRL_KEY_INSERT:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[2~", handler, context);
-		break;
-	case TINYRL_KEY_DELETE:
-		tinyrl_bind_keyseq(this, ESCAPESTR "[3~", handler, context);
-		break;
-	}
+	tinyrl_bind_code(this, SPECIAL(key, modifiers % KEY_MODIFIERS),
+			 handler, context);
 }
 
 void tinyrl_bind_key(struct tinyrl *this, unsigned char key,
 		     tinyrl_key_func_t *handler, void *context)
 {
-	this->keymap->handler[key] = handler;
-	this->keymap->context[key] = context;
+	tinyrl_bind_code(this, key, handler, context);
 }
 
 void tinyrl_crlf(struct tinyrl *this)
 {
+	if (this->last_suggested && this->last_valid) {
+		/* don't leave the suggestion behind */
+		this->suggest_hidden = true;
+		tinyrl_redisplay(this);
+		this->suggest_hidden = false;
+	}
 	tinyrl_printf(this, "\n");
 }
 
@@ -972,22 +2373,56 @@ void tinyrl_crlf(struct tinyrl *this)
 void tinyrl_ding(struct tinyrl *this)
 {
 	tinyrl_printf(this, "\x7");
-	fflush(this->ostream);
+	tinyrl_flush(this);
 }
 
 void tinyrl_reset_line_state(struct tinyrl *this)
 {
 	/* start from scratch */
-	free(this->last_buffer);
-	this->last_buffer = NULL;
+	this->last_valid = false;
 
 	tinyrl_redisplay(this);
 }
 
 void tinyrl_set_line(struct tinyrl *this, const char *text)
 {
+	unsigned old_end = this->end;
+
 	this->line = text ?: this->buffer;
 	this->point = this->end = strlen(this->line);
+	this->layout_line = NULL;
+	tinyrl_edited(this, 0, old_end, this->end);
+}
+
+void tinyrl_measure_line(const char *text, size_t len,
+			 struct tinyrl_line_layout *layout)
+{
+	size_t point, next, width;
+
+	layout->len = len;
+	layout->width = 0;
+	layout->graphemes = 0;
+	layout->narrow = true;
+	for (point = 0; point < len; point = next) {
+		width = utf8_grapheme_width(text, len, point, &next);
+		layout->width += width;
+		layout->graphemes++;
+		if (width > 1)
+			layout->narrow = false;
+	}
+}
+
+void tinyrl_set_line_layout(struct tinyrl *this, const char *text,
+			    const struct tinyrl_line_layout *layout)
+{
+	unsigned old_end = this->end;
+
+	this->line = text;
+	this->point = this->end = layout->len;
+	/* the buffer is edited in place, so its layout can't be kept */
+	this->layout_line = text != this->buffer ? text : NULL;
+	this->layout = *layout;
+	tinyrl_edited(this, 0, old_end, this->end);
 }
 
 void tinyrl_replace_line(struct tinyrl *this, const char *text)
@@ -995,8 +2430,12 @@ void tinyrl_replace_line(struct tinyrl *this, const char *text)
 	size_t new_len = strlen(text);
 
 	if (tinyrl_extend_line_buffer(this, new_len)) {
+		unsigned old_end = this->end;
+
 		strcpy(this->buffer, text);
+		this->line = this->buffer;
 		this->point = this->end = new_len;
+		tinyrl_edited(this, 0, old_end, new_len);
 	}
 	tinyrl_redisplay(this);
 }
@@ -1015,12 +2454,21 @@ size_t tinyrl__get_width(const struct tinyrl *this)
 {
 	struct winsize ws;
 
-	if (ioctl(fileno(this->ostream), TIOCGWINSZ, &ws) != -1 && ws.ws_col)
+	if (this->width)
+		return this->width;
+
+	if (this->ostream
+	    && ioctl(fileno(this->ostream), TIOCGWINSZ, &ws) != -1 && ws.ws_col)
 		return ws.ws_col;
 
 	return 80;
 }
 
+void tinyrl_set_width(struct tinyrl *this, size_t width)
+{
+	this->width = width;
+}
+
 void tinyrl_done(struct tinyrl *this)
 {
 	this->done = true;
@@ -1041,3 +2489,389 @@ void tinyrl_limit_line_length(struct tinyrl *this, unsigned length)
 {
 	this->max_line_length = length;
 }
+
+void tinyrl_set_tty(struct tinyrl *this, bool isatty)
+{
+	this->isatty = isatty;
+}
+
+void tinyrl_begin_session(struct tinyrl *this)
+{
+	this->session = true;
+	tinyrl_enter_raw_mode(this);
+}
+
+void tinyrl_end_session(struct tinyrl *this)
+{
+	this->session = false;
+	tinyrl_leave_raw_mode(this);
+}
+
+bool tinyrl_post(struct tinyrl *this, const char *text)
+{
+	struct tinyrl_message *msg, *head;
+	size_t len = strlen(text);
+	ssize_t n;
+
+	msg = this->alloc.malloc(this->alloc.context, sizeof(*msg) + len);
+	if (!msg)
+		return false;
+	msg->len = len;
+	memcpy(msg->text, text, len);
+
+	/* push onto the queue: any number of threads may be doing so */
+	head = __atomic_load_n(&this->posted, __ATOMIC_RELAXED);
+	do {
+		msg->next = head;
+	} while (!__atomic_compare_exchange_n(&this->posted, &head, msg, true,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+
+	/* the reader only needs waking for the first of a burst */
+	if (!head) {
+		if (this->wake[1] >= 0) {
+			/* a full pipe is as good as a write */
+			n = write(this->wake[1], "", 1);
+			(void)n;
+		}
+		if (this->post_notify)
+			this->post_notify(this->post_context);
+	}
+	return true;
+}
+
+void tinyrl_print_posted(struct tinyrl *this)
+{
+	struct tinyrl_message *msg, *next;
+	bool redraw, reading = this->reading;
+
+	msg = tinyrl_take_posted(this);
+	if (!msg)
+		return;
+
+	/* erase the prompt and line, from the start of the prompt down */
+	redraw = this->reading && this->isatty && this->last_valid;
+	if (redraw) {
+		tinyrl_printf(this, "\r");
+		if (this->last_point_row)
+			tinyrl_vt100_cursor_up(this, this->last_point_row);
+		tinyrl_vt100_erase_down(this);
+	}
+
+	/* write them into one frame, with the redrawn line */
+	this->reading = true;
+	for (; msg; msg = next) {
+		next = msg->next;
+		tinyrl_write(this, msg->text, msg->len);
+		if (!msg->len || msg->text[msg->len - 1] != '\n')
+			tinyrl_write(this, "\n", 1);
+		this->alloc.free(this->alloc.context, msg);
+	}
+	if (redraw) {
+		this->last_valid = false;
+		tinyrl_redisplay(this);
+	}
+	this->reading = reading;
+	tinyrl_flush(this);
+}
+
+void tinyrl_set_escape_timeout(struct tinyrl *this, unsigned ms)
+{
+	this->escape_timeout = ms;
+}
+
+void tinyrl_set_post_notify(struct tinyrl *this,
+			    tinyrl_notify_func_t *notify, void *context)
+{
+	this->post_notify = notify;
+	this->post_context = context;
+}
+
+void tinyrl_set_batch_echo(struct tinyrl *this, bool echo)
+{
+	this->batch_echo = echo;
+}
+
+void tinyrl_get_stats(const struct tinyrl *this, struct tinyrl_stats *stats)
+{
+	stats->line_bytes = this->buffer ? this->buffer_size + 1 : 0;
+	stats->display_bytes = this->display_size + this->last_size;
+	stats->kill_bytes = this->kill_size;
+	stats->keymap_bytes = this->bindings_size * sizeof(*this->bindings);
+	stats->input_bytes = this->input_size;
+	stats->output_bytes = this->output_size;
+	stats->highlight_bytes = this->styles_size + this->spans_size
+		+ this->display_styles_size + this->last_styles_size;
+	stats->total_bytes = sizeof(*this)
+		+ stats->line_bytes + stats->display_bytes + stats->kill_bytes
+		+ stats->keymap_bytes + stats->input_bytes + stats->output_bytes
+		+ stats->highlight_bytes;
+	stats->allocs = this->allocs;
+	stats->frees = this->frees;
+}
+
+void tinyrl_trim(struct tinyrl *this)
+{
+	struct tinyrl_binding *bindings;
+	char *buffer;
+
+	if (this->reading)
+		return;
+
+	tinyrl_trim_buffers(this, 0);
+
+	if (this->restored) {
+		/* the line buffer holds the next line, so just shrink it */
+		if (this->buffer_size > this->end) {
+			buffer = tinyrl__realloc(this, this->buffer,
+						 this->end + 1);
+			if (buffer) {
+				this->line = this->buffer = buffer;
+				this->buffer_size = this->end;
+			}
+		}
+	} else {
+		/* the line buffer only holds the result of the last line */
+		tinyrl__free(this, this->buffer);
+		this->buffer = NULL;
+		this->buffer_size = 0;
+		this->line = NULL;
+	}
+
+	if (this->bindings_size > this->bindings_len) {
+		if (this->bindings_len) {
+			bindings = tinyrl__realloc(this, this->bindings,
+						   this->bindings_len
+						   * sizeof(*bindings));
+		} else {
+			tinyrl__free(this, this->bindings);
+			bindings = NULL;
+		}
+		if (bindings || !this->bindings_len) {
+			this->bindings = bindings;
+			this->bindings_size = this->bindings_len;
+		}
+	}
+}
+
+void tinyrl_set_trim_threshold(struct tinyrl *this, size_t bytes)
+{
+	this->trim_threshold = bytes;
+}
+
+bool tinyrl_get_latency(const struct tinyrl *this,
+			struct tinyrl_latency *latency)
+{
+#ifdef TINYRL_LATENCY_STATS
+	*latency = this->latency;
+	return true;
+#else
+	memset(latency, 0, sizeof(*latency));
+	return false;
+#endif
+}
+
+void tinyrl_reset_latency(struct tinyrl *this)
+{
+#ifdef TINYRL_LATENCY_STATS
+	memset(&this->latency, 0, sizeof(this->latency));
+#endif
+}
+
+const char *tinyrl_latency_stage_name(enum tinyrl_latency_stage stage)
+{
+	static const char *const names[TINYRL_LATENCY_STAGES] = {
+		[TINYRL_LATENCY_READ] = "read",
+		[TINYRL_LATENCY_DISPATCH] = "dispatch",
+		[TINYRL_LATENCY_HANDLER] = "handler",
+		[TINYRL_LATENCY_REDISPLAY] = "redisplay",
+		[TINYRL_LATENCY_FLUSH] = "flush",
+		[TINYRL_LATENCY_KEY] = "key",
+	};
+
+	return stage < TINYRL_LATENCY_STAGES ? names[stage] : NULL;
+}
+
+uint64_t tinyrl_histogram_percentile(const struct tinyrl_histogram *histogram,
+				     double fraction)
+{
+	unsigned long rank, seen = 0;
+	uint64_t bound;
+	unsigned i;
+
+	if (!histogram->count)
+		return 0;
+	rank = fraction * histogram->count;
+	if (rank >= histogram->count)
+		rank = histogram->count - 1;
+	for (i = 0; i < TINYRL_HISTOGRAM_BUCKETS - 1; i++) {
+		seen += histogram->bucket[i];
+		if (seen > rank)
+			break;
+	}
+	bound = i ? ((uint64_t)1 << i) - 1 : 0;
+	return bound < histogram->max ? bound : histogram->max;
+}
+
+size_t tinyrl_snapshot(const struct tinyrl *this, void *buf, size_t size)
+{
+	struct tinyrl_snapshot header = {
+		.magic = "TRLS",
+		.version = 1,
+		.kill_len = TINYRL_SNAPSHOT_NO_KILL,
+	};
+	size_t len;
+	char *p = buf;
+
+	/*
+	 * only a line which is being edited is unfinished, or one restored
+	 * for the next line to start with
+	 */
+	if ((this->reading || this->restored) && this->line) {
+		header.line_len = this->end;
+		header.point = this->point;
+	}
+	if (this->kill_string)
+		header.kill_len = strlen(this->kill_string);
+
+	len = sizeof(header) + header.line_len;
+	if (this->kill_string)
+		len += header.kill_len;
+	if (len > size)
+		return len;
+
+	memcpy(p, &header, sizeof(header));
+	p += sizeof(header);
+	memcpy(p, this->line, header.line_len);
+	p += header.line_len;
+	if (this->kill_string)
+		memcpy(p, this->kill_string, header.kill_len);
+	return len;
+}
+
+bool tinyrl_restore(struct tinyrl *this, const void *buf, size_t len)
+{
+	struct tinyrl_snapshot header;
+	const char *line, *kill;
+	size_t kill_len;
+	unsigned old_end;
+
+	if (len < sizeof(header))
+		return false;
+	memcpy(&header, buf, sizeof(header));
+	if (memcmp(header.magic, "TRLS", 4) != 0 || header.version != 1)
+		return false;
+	kill_len = header.kill_len == TINYRL_SNAPSHOT_NO_KILL
+		? 0 : header.kill_len;
+	if (len - sizeof(header) < (size_t)header.line_len + kill_len
+	    || header.point > header.line_len)
+		return false;
+	line = (const char *)buf + sizeof(header);
+	kill = line + header.line_len;
+	if (memchr(line, '\0', header.line_len) || memchr(kill, '\0', kill_len))
+		return false;
+
+	if (this->max_line_length && header.line_len >= this->max_line_length)
+		return false;
+
+	/* make room in both buffers first, so that a failure changes nothing */
+	if (header.kill_len != TINYRL_SNAPSHOT_NO_KILL
+	    && !tinyrl_reserve(this, &this->kill_string, &this->kill_size,
+			       kill_len + 1))
+		return false;
+	if (!tinyrl_extend_line_buffer(this, header.line_len))
+		return false;
+	if (!this->buffer) {
+		/* an empty line, with no buffer yet */
+		this->buffer = tinyrl__malloc(this, 1);
+		if (!this->buffer)
+			return false;
+		this->buffer_size = 0;
+	}
+
+	/* straight into the buffers, without going through the editor */
+	if (header.kill_len == TINYRL_SNAPSHOT_NO_KILL) {
+		tinyrl__free(this, this->kill_string);
+		this->kill_string = NULL;
+		this->kill_size = 0;
+	} else {
+		memcpy(this->kill_string, kill, kill_len);
+		this->kill_string[kill_len] = '\0';
+	}
+	memcpy(this->buffer, line, header.line_len);
+	this->buffer[header.line_len] = '\0';
+	this->line = this->buffer;
+	old_end = this->end;
+	this->end = header.line_len;
+	this->point = header.point;
+	tinyrl_edited(this, 0, old_end, this->end);
+
+	/* redraw a line which is being edited, or start the next with it */
+	if (this->reading)
+		tinyrl_reset_line_state(this);
+	else
+		this->restored = true;
+	return true;
+}
+
+void tinyrl_set_edit_observer(struct tinyrl *this,
+			      tinyrl_edit_func_t *observer, void *context)
+{
+	this->edit_observer = observer;
+	this->edit_context = context;
+}
+
+void tinyrl_set_highlight(struct tinyrl *this,
+			  tinyrl_highlight_func_t *highlight, void *context)
+{
+	this->highlight = highlight;
+	this->highlight_context = context;
+	this->styles_len = 0;
+}
+
+void tinyrl_set_style(struct tinyrl *this, unsigned style, const char *sgr)
+{
+	if (style && style <= TINYRL_STYLE_SUGGESTION)
+		this->style_sgr[style] = sgr;
+}
+
+void tinyrl_set_suggest(struct tinyrl *this, tinyrl_suggest_func_t *suggest,
+			void *context)
+{
+	this->suggest = suggest;
+	this->suggest_context = context;
+	this->suggest_valid = false;
+}
+
+bool tinyrl_accept_suggestion(struct tinyrl *this)
+{
+	size_t len;
+	const char *suggestion;
+
+	if (!this->last_suggested)
+		return false;
+	suggestion = tinyrl_get_suggestion(this, &len);
+	if (!len)
+		return false;
+	return tinyrl_insert_text_len(this, suggestion, len);
+}
+
+void tinyrl_set_recorder(struct tinyrl *this, struct tinyrl_recorder *recorder)
+{
+	this->recorder = recorder;
+}
+
+struct tinyrl_recorder *tinyrl_get_recorder(const struct tinyrl *this)
+{
+	return this->recorder;
+}
+
+void tinyrl_set_usage(struct tinyrl *this, struct tinyrl_usage *usage)
+{
+	this->usage = usage;
+}
+
+struct tinyrl_usage *tinyrl_get_usage(const struct tinyrl *this)
+{
+	return this->usage;
+}
@@ -15,6 +15,8 @@
 #include <stdio.h>
 
 struct tinyrl;
+struct tinyrl_recorder;
+struct tinyrl_usage;
 
 enum tinyrl_key {
 	TINYRL_KEY_UP,
@@ -25,6 +27,28 @@ enum tinyrl_key {
 	TINYRL_KEY_END,
 	TINYRL_KEY_INSERT,
 	TINYRL_KEY_DELETE,
+	TINYRL_KEY_PAGE_UP,
+	TINYRL_KEY_PAGE_DOWN,
+	TINYRL_KEY_F1,
+	TINYRL_KEY_F2,
+	TINYRL_KEY_F3,
+	TINYRL_KEY_F4,
+	TINYRL_KEY_F5,
+	TINYRL_KEY_F6,
+	TINYRL_KEY_F7,
+	TINYRL_KEY_F8,
+	TINYRL_KEY_F9,
+	TINYRL_KEY_F10,
+	TINYRL_KEY_F11,
+	TINYRL_KEY_F12,
+	TINYRL_KEYS
+};
+
+/* modifiers held with a special key, as xterm reports them */
+enum tinyrl_modifier {
+	TINYRL_MOD_SHIFT = 1,
+	TINYRL_MOD_ALT = 2,
+	TINYRL_MOD_CTRL = 4,
 };
 
 /**
@@ -35,25 +59,249 @@ enum tinyrl_key {
  */
 typedef bool tinyrl_key_func_t(void *context, char *key);
 
+/**
+ * Output sink.  Output is buffered by the instance and handed over a
+ * whole frame at a time (e.g. one redisplay), so buf is only valid for
+ * the duration of the call.
+ */
+typedef void tinyrl_write_func_t(void *context, const char *buf, size_t len);
+
+/**
+ * Input source.  Read up to len bytes into buf, returning the number of
+ * bytes read, or -1 at the end of the input.  If block is false and no
+ * input is pending, return 0 immediately instead of waiting.  A blocking
+ * read may also return 0 once a message has been posted with
+ * tinyrl_post(), so that it is printed without waiting for a key.
+ */
+typedef int tinyrl_read_func_t(void *context, char *buf, size_t len, bool block);
+
+/**
+ * Called by tinyrl_post() on the posting thread when there were no
+ * messages waiting, to wake the thread which is editing the line.
+ */
+typedef void tinyrl_notify_func_t(void *context);
+
+/**
+ * Called after each change to the line: removed bytes at offset were
+ * replaced by inserted bytes, which are now at line + offset.  line is
+ * the whole line after the change, and is only valid during the call.
+ */
+typedef void tinyrl_edit_func_t(void *context, const char *line,
+				size_t offset, size_t removed, size_t inserted);
+
+/**
+ * Memory allocator hooks.  Each function is passed the context pointer,
+ * and realloc and free behave as their standard C counterparts.
+ */
+struct tinyrl_allocator {
+	void *(*malloc)(void *context, size_t size);
+	void *(*realloc)(void *context, void *ptr, size_t size);
+	void (*free)(void *context, void *ptr);
+	void *context;
+};
+
 /* exported functions */
+#ifndef TINYRL_STATIC_MEMORY
+/*
+ * These constructors, and tinyrl_readline(), use the C library's heap and
+ * so are not available when tinyrl is built with TINYRL_STATIC_MEMORY.
+ * Input is read from instream's descriptor, so instream is made unbuffered
+ * here, and must not have been read through stdio before.
+ */
 struct tinyrl *tinyrl_new(FILE * instream, FILE * outstream);
 
+/**
+ * Create an instance which writes its output to a callback rather
+ * than a stdio stream.  The terminal width can not be probed for such
+ * an instance, so use tinyrl_set_width() to supply it.
+ */
+struct tinyrl *tinyrl_new_sink(FILE * instream,
+			       tinyrl_write_func_t *write, void *context);
+
+/**
+ * Create an instance with both input and output supplied by callbacks,
+ * sharing the same context.  No terminal handling is done for such an
+ * instance: the caller is responsible for any raw mode on its transport,
+ * should supply the width with tinyrl_set_width(), and may use
+ * tinyrl_set_tty() to select non-interactive line reading.
+ */
+struct tinyrl *tinyrl_new_io(tinyrl_read_func_t *read,
+			     tinyrl_write_func_t *write, void *context);
+#endif
+
+/**
+ * As tinyrl_new_io(), but all memory used by the instance, and by the
+ * history and completion matches created for it, is obtained from alloc.
+ * A NULL alloc uses the C library, except in a TINYRL_STATIC_MEMORY build
+ * where it is an error.
+ *
+ * Once the line buffer and display buffers have grown to fit the longest
+ * line edited, ordinary editing and redisplay do not allocate memory.
+ */
+struct tinyrl *tinyrl_new_alloc(const struct tinyrl_allocator *alloc,
+				tinyrl_read_func_t *read,
+				tinyrl_write_func_t *write, void *context);
+
+/**
+ * As tinyrl_new(), but with all of the instance's memory taken from the
+ * size bytes at mem (see tinyrl_mempool_init()), so no heap is needed.
+ * When built with TINYRL_STATIC_MEMORY the line length is limited to 256
+ * bytes by default, so that memory use is bounded.
+ */
+struct tinyrl *tinyrl_new_static(void *mem, size_t size,
+				 FILE * instream, FILE * outstream);
+
 /*lint -esym(534,tinyrl_printf)  Ignoring return value of function */
 int tinyrl_printf(struct tinyrl *instance, const char *fmt, ...);
 
 void tinyrl_delete(struct tinyrl *instance);
 
+/**
+ * Return an instance to the state of one just created by tinyrl_new_io()
+ * with the given callbacks, for reuse by another session.  The buffers
+ * it has grown, and the memory of its key bindings, are kept so that this
+ * is much cheaper than deleting it and creating another, but the keys are
+ * bound as they were at first.  Anything queued by tinyrl_post() is
+ * discarded, as is the kill buffer.  A recorder or usage model is
+ * detached, and must still be deleted while the instance exists.
+ */
+void tinyrl_reset(struct tinyrl *instance, tinyrl_read_func_t *read,
+		  tinyrl_write_func_t *write, void *context);
+
 void tinyrl_done(struct tinyrl *instance);
 
 size_t tinyrl__get_width(const struct tinyrl *instance);
 
+/* allocate memory using the instance's allocator */
+void *tinyrl__malloc(const struct tinyrl *instance, size_t size);
+void *tinyrl__realloc(const struct tinyrl *instance, void *ptr, size_t size);
+void tinyrl__free(const struct tinyrl *instance, void *ptr);
+char *tinyrl__strdup(const struct tinyrl *instance, const char *s);
+
+/**
+ * Set the terminal width in columns.
+ *
+ * 0 probes the output stream (the default)
+ */
+void tinyrl_set_width(struct tinyrl *instance, size_t width);
+
+/**
+ * Select interactive (true) or non-interactive line reading.
+ *
+ * The default for a stdio instance is whether its input is a terminal,
+ * and true for a callback instance.
+ */
+void tinyrl_set_tty(struct tinyrl *instance, bool isatty);
+
+/**
+ * Control whether non-interactive input is echoed to the output along
+ * with the prompt, as a terminal would.  Disabling this is much faster
+ * when scripts feed in large amounts of input. (Echo is the default)
+ */
+void tinyrl_set_batch_echo(struct tinyrl *instance, bool echo);
+
+#ifndef TINYRL_STATIC_MEMORY
+/**
+ * Read a line.  The result is allocated with malloc(), whatever allocator
+ * the instance uses, and must be freed by the caller.
+ */
 char *tinyrl_readline(struct tinyrl *instance, const char *prompt);
+#endif
+
+/**
+ * As tinyrl_readline(), but rather than returning a copy which the caller
+ * must free, the line is returned in the instance's own buffer.  It remains
+ * valid until the next call on the instance, and the buffer is reused so
+ * that reading a line does not normally allocate memory.
+ *
+ * If len is not NULL then it is set to the length of the line.
+ */
+const char *tinyrl_readline_ref(struct tinyrl *instance, const char *prompt,
+				size_t *len);
+
+/**
+ * Event driven line reading, for servers which multiplex many sessions
+ * on one thread.  tinyrl_line_begin() draws the prompt.  Then, whenever
+ * input may be ready, tinyrl_line_process() handles all the input which
+ * the read callback returns without blocking, and returns true once the
+ * line is finished, setting line and len as tinyrl_readline_ref() would
+ * (line is NULL at the end of input).  Otherwise the result is false and
+ * nothing is set.
+ *
+ * Input for the next line may already be buffered, so call
+ * tinyrl_line_process() again after tinyrl_line_begin() rather than
+ * waiting for more to arrive.  This reads lines interactively, whatever
+ * tinyrl_set_tty() says.
+ */
+bool tinyrl_line_begin(struct tinyrl *instance, const char *prompt);
+bool tinyrl_line_process(struct tinyrl *instance, const char **line,
+			 size_t *len);
+
+/**
+ * The milliseconds until tinyrl_line_process() needs to be called again
+ * even if no more input arrives, or -1 if it does not.  This is while an
+ * ESC has arrived without the rest of its escape sequence: when the
+ * timeout passes it is handled as a key by itself.  Use it as the timeout
+ * of poll() or epoll_wait().
+ */
+int tinyrl_line_timeout(const struct tinyrl *instance);
+
+/**
+ * Keep the terminal in raw mode from now until tinyrl_end_session(),
+ * instead of switching modes around every tinyrl_readline() call.
+ * Input typed while the application is busy between lines is then
+ * neither echoed by the terminal nor lost, and is read by the next call.
+ */
+void tinyrl_begin_session(struct tinyrl *instance);
+void tinyrl_end_session(struct tinyrl *instance);
+
+/**
+ * Queue a message to be printed above the line being edited.  Unlike the
+ * rest of the API this may be called from any thread, as long as the
+ * instance's allocator may be too (the C library's can, the static memory
+ * pool can not).  A newline is added if the text does not end with one.
+ *
+ * The messages are printed, oldest first, by the thread which reads lines:
+ * while a line is being edited, its area of the screen is erased once, all
+ * of the messages waiting are printed and the prompt and line are redrawn
+ * once, so a burst of messages costs a single redraw.  An instance reading
+ * a terminal through stdio wakes up to print them itself.  Otherwise use
+ * tinyrl_set_post_notify() to wake the reading thread, which then calls
+ * tinyrl_print_posted() (tinyrl_line_process() does so too).
+ */
+bool tinyrl_post(struct tinyrl *instance, const char *text);
+void tinyrl_print_posted(struct tinyrl *instance);
+
+/**
+ * Set how long to wait for the rest of an escape sequence which arrives
+ * in pieces, such as over a slow link, before taking the ESC which starts
+ * it as a key by itself.  The default is 100ms.  No bytes are dropped
+ * either way: those after a lone ESC are read as keys of their own.
+ */
+void tinyrl_set_escape_timeout(struct tinyrl *instance, unsigned ms);
+
+/* set before any messages are posted */
+void tinyrl_set_post_notify(struct tinyrl *instance,
+			    tinyrl_notify_func_t *notify, void *context);
 
 void tinyrl_bind_key(struct tinyrl *instance, unsigned char key,
 		     tinyrl_key_func_t *handler, void *context);
 void tinyrl_bind_special(struct tinyrl *instance, enum tinyrl_key key,
 			 tinyrl_key_func_t *handler, void *context);
 
+/* bind key as it was at first if it is still bound to handler and context */
+void tinyrl_unbind_special(struct tinyrl *instance, enum tinyrl_key key,
+			   tinyrl_key_func_t *handler, void *context);
+
+/**
+ * Bind a special key pressed with modifiers, a combination of enum
+ * tinyrl_modifier.  A modified key which has no binding of its own does
+ * what the key does alone.
+ */
+void tinyrl_bind_special_mod(struct tinyrl *instance, enum tinyrl_key key,
+			     unsigned modifiers,
+			     tinyrl_key_func_t *handler, void *context);
+
 void tinyrl_crlf(struct tinyrl *instance);
 void tinyrl_ding(struct tinyrl *instance);
 
@@ -69,8 +317,110 @@ void tinyrl_redisplay(struct tinyrl *instance);
 /* text must be persistent */
 void tinyrl_set_line(struct tinyrl *instance, const char *text);
 
+/**
+ * The measurements of a line of text, so that one which is kept, such as
+ * a history entry, need only be measured once.
+ */
+struct tinyrl_line_layout {
+	size_t len;		/* bytes */
+	size_t width;		/* columns */
+	size_t graphemes;
+	bool narrow;		/* no grapheme is more than a column wide */
+};
+
+void tinyrl_measure_line(const char *text, size_t len,
+			 struct tinyrl_line_layout *layout);
+
+/**
+ * Like tinyrl_set_line(), for text measured by tinyrl_measure_line().
+ * Neither its length nor, when it is next redrawn, its layout on the
+ * screen is worked out again, so the text must not change while it is
+ * the line.
+ */
+void tinyrl_set_line_layout(struct tinyrl *instance, const char *text,
+			    const struct tinyrl_line_layout *layout);
+
 void tinyrl_replace_line(struct tinyrl *instance, const char *text);
 
+/**
+ * Report every change to the line to an observer, or to none if observer
+ * is NULL, so that it can keep up by looking at just the text which
+ * changed rather than the whole line.  This covers editing keys, and
+ * tinyrl_insert_text(), tinyrl_delete_text(), tinyrl_set_line(),
+ * tinyrl_replace_line() and tinyrl_restore().  Starting a new line is
+ * reported as removing all of the last one.
+ */
+void tinyrl_set_edit_observer(struct tinyrl *instance,
+			      tinyrl_edit_func_t *observer, void *context);
+
+/**
+ * Syntax highlighting.  Each byte of the line has a style, 0 being the
+ * terminal's default and the others set by tinyrl_set_style().
+ */
+#define TINYRL_STYLES 16
+#define TINYRL_STYLE_SUGGESTION TINYRL_STYLES	/* suggestions' own style */
+
+struct tinyrl_span {
+	size_t start;
+	size_t end;
+	unsigned style;
+};
+
+/**
+ * Style the region of line from *start to *end, which covers at least the
+ * text changed since the last call and is widened to whole words, by
+ * filling in up to max spans and returning how many there are.  If that is
+ * more than max it is called again with room for them all.  The region may
+ * be widened further, such as to the rest of the line when its first word
+ * changes.  The region is cleared to style 0 before the spans are applied,
+ * and the parts of spans outside it are ignored.  The styles outside it
+ * are kept from earlier calls.
+ */
+typedef size_t tinyrl_highlight_func_t(void *context, const char *line,
+				       size_t len, size_t *start, size_t *end,
+				       struct tinyrl_span *spans, size_t max);
+
+/**
+ * Highlight the line with highlight, or stop if it is NULL.  It is called
+ * by tinyrl_redisplay() for the region which has changed, and only the
+ * cells whose text or style has changed are redrawn.  Lines which are not
+ * echoed are never highlighted.
+ */
+void tinyrl_set_highlight(struct tinyrl *instance,
+			  tinyrl_highlight_func_t *highlight, void *context);
+
+/**
+ * Set the SGR parameters for a style, such as "1;32" for bold green,
+ * including TINYRL_STYLE_SUGGESTION.  sgr must be persistent.  A style with
+ * none is drawn as style 0.
+ */
+void tinyrl_set_style(struct tinyrl *instance, unsigned style,
+		      const char *sgr);
+
+/**
+ * Return the text to suggest after line, such as the rest of a history
+ * entry which starts with it, or NULL for none.  It is only called when the
+ * line has changed, and the text must stay valid until the line changes
+ * again or tinyrl_set_suggest() is called.
+ */
+typedef const char *tinyrl_suggest_func_t(void *context, const char *line,
+					  size_t len);
+
+/**
+ * Show suggestions from suggest, or none if it is NULL.  While the cursor
+ * is at the end of the line a suggestion is drawn after it in the
+ * TINYRL_STYLE_SUGGESTION style (dim by default), and Right or End
+ * accepts it.  It is part of what tinyrl_redisplay() draws and diffs, so
+ * it comes and goes without redrawing the line.  Call this again when the
+ * suggestions have changed, such as when the text of the last one has been
+ * freed.
+ */
+void tinyrl_set_suggest(struct tinyrl *instance,
+			tinyrl_suggest_func_t *suggest, void *context);
+
+/* insert the suggestion being shown, for binding to other keys */
+bool tinyrl_accept_suggestion(struct tinyrl *instance);
+
 /**
  * This operation returns the current line in use by the tinyrl instance
  * NB. the pointer will become invalid after any further operation on the 
@@ -94,6 +444,154 @@ void tinyrl_disable_echo(struct tinyrl *instance, char echo_char);
  */
 void tinyrl_enable_echo(struct tinyrl *instance);
 
+/**
+ * The header of a snapshot, followed by the line and the kill string,
+ * without terminators.  It is in host byte order, for restoring on the
+ * same machine, such as after a restart.
+ */
+struct tinyrl_snapshot {
+	char magic[4];		/* "TRLS" */
+	uint16_t version;	/* 1 */
+	uint16_t reserved;
+	uint32_t line_len;	/* 0 if no line was being edited */
+	uint32_t point;
+	uint32_t kill_len;	/* TINYRL_SNAPSHOT_NO_KILL if none */
+};
+#define TINYRL_SNAPSHOT_NO_KILL UINT32_MAX
+
+/**
+ * Save the line being edited, or one restored for the next line to start
+ * with, its insertion point and the kill buffer into buf.  The result is
+ * the size of the snapshot, and nothing is written if that is more than
+ * size, so a size of 0 asks how much room is needed.
+ */
+size_t tinyrl_snapshot(const struct tinyrl *instance, void *buf, size_t size);
+
+/**
+ * Restore a snapshot straight into the instance's buffers.  If a line is
+ * being read it is replaced and redrawn, otherwise the next line read
+ * starts with the restored one.  The result is false if the snapshot is
+ * not valid, or the line does not fit (see tinyrl_limit_line_length()),
+ * in which case the instance is left unchanged.
+ */
+bool tinyrl_restore(struct tinyrl *instance, const void *buf, size_t len);
+
+/**
+ * Memory held by an instance, in bytes, and the number of allocations
+ * and frees made for it since it was created (including those for its
+ * history and completion matches).  Allocator overheads are not included.
+ */
+struct tinyrl_stats {
+	size_t line_bytes;	/* line buffer */
+	size_t display_bytes;	/* current and previous display */
+	size_t kill_bytes;	/* kill (cut) buffer */
+	size_t keymap_bytes;	/* key bindings */
+	size_t input_bytes;	/* input buffer */
+	size_t output_bytes;	/* output buffer */
+	size_t highlight_bytes;	/* styles of the line and display */
+	size_t total_bytes;	/* all of the above, plus the instance */
+	unsigned long allocs;	/* allocations, including reallocations */
+	unsigned long frees;
+};
+
+/**
+ * Fill in stats for the instance.  This is cheap enough to poll.
+ */
+void tinyrl_get_stats(const struct tinyrl *instance, struct tinyrl_stats *stats);
+
+/**
+ * Release the memory which an idle instance does not need: the display,
+ * input and output buffers, the line buffer (so the last result from
+ * tinyrl_readline_ref() becomes invalid), and any spare capacity in the
+ * kill buffer and key bindings.  All of it is reallocated on demand.
+ *
+ * This has no effect while a line is being read.
+ */
+void tinyrl_trim(struct tinyrl *instance);
+
+/**
+ * Automatically release any buffer which has grown beyond bytes once a
+ * line has been read, so that one very long line does not leave an idle
+ * instance holding a large amount of memory.
+ *
+ * 0 never releases buffers (the default)
+ */
+void tinyrl_set_trim_threshold(struct tinyrl *instance, size_t bytes);
+
+/**
+ * Record editor events into recorder, or stop recording if it is NULL.
+ * (tinyrl_recorder_new() does this for you.)
+ */
+void tinyrl_set_recorder(struct tinyrl *instance,
+			 struct tinyrl_recorder *recorder);
+struct tinyrl_recorder *tinyrl_get_recorder(const struct tinyrl *instance);
+
+/**
+ * Count the words of lines added to the history in usage, and rank
+ * completion matches by it, or stop if it is NULL.  (tinyrl_usage_new()
+ * does this for you.)
+ */
+void tinyrl_set_usage(struct tinyrl *instance, struct tinyrl_usage *usage);
+struct tinyrl_usage *tinyrl_get_usage(const struct tinyrl *instance);
+
+/**
+ * Latency instrumentation, which is only collected when tinyrl is built
+ * with TINYRL_LATENCY_STATS (the LATENCY_STATS CMake option).  Otherwise
+ * none of the timing code is compiled in and tinyrl_get_latency() fails.
+ */
+enum tinyrl_latency_stage {
+	TINYRL_LATENCY_READ,		/* polling the read callback mid key */
+	TINYRL_LATENCY_DISPATCH,	/* tinyrl_handle_key(), in total */
+	TINYRL_LATENCY_HANDLER,		/* the key handler alone */
+	TINYRL_LATENCY_REDISPLAY,	/* tinyrl_redisplay(), excluding flush */
+	TINYRL_LATENCY_FLUSH,		/* the write callback */
+	TINYRL_LATENCY_KEY,		/* key received to its output flushed */
+	TINYRL_LATENCY_STAGES
+};
+
+#define TINYRL_HISTOGRAM_BUCKETS 32
+
+/**
+ * A log2 histogram.  Bucket 0 counts zero values, and bucket i counts
+ * values from 2^(i-1) to 2^i - 1, with the last bucket also counting
+ * anything larger.
+ */
+struct tinyrl_histogram {
+	unsigned long count;
+	uint64_t sum;
+	uint64_t max;
+	unsigned long bucket[TINYRL_HISTOGRAM_BUCKETS];
+};
+
+/**
+ * Per-stage times in nanoseconds, and the bytes written per flush.
+ */
+struct tinyrl_latency {
+	struct tinyrl_histogram stage[TINYRL_LATENCY_STAGES];
+	struct tinyrl_histogram frame_bytes;
+};
+
+/**
+ * Copy the instance's latency histograms to latency.  The result is false
+ * if instrumentation was not compiled in.
+ */
+bool tinyrl_get_latency(const struct tinyrl *instance,
+			struct tinyrl_latency *latency);
+
+/**
+ * Clear the instance's latency histograms.
+ */
+void tinyrl_reset_latency(struct tinyrl *instance);
+
+const char *tinyrl_latency_stage_name(enum tinyrl_latency_stage stage);
+
+/**
+ * Return an upper bound for the given fraction (e.g. 0.99) of the values
+ * in histogram, from the bucket it falls in.
+ */
+uint64_t tinyrl_histogram_percentile(const struct tinyrl_histogram *histogram,
+				     double fraction);
+
 /**
  * Limit maximum line length
  *
@@ -0,0 +1,147 @@
+/*
+ * usage.c
+ *
+ * A model of how often and how recently words are used
+ */
+#include <ctype.h>
+#include <string.h>
+
+#include "tinyrl.h"
+#include "usage.h"
+
+#define WAYS 4			/* words which compete for a place */
+#define USE 256			/* the score of one use */
+
+/* hash 0 is an empty place */
+struct usage_word {
+	uint32_t hash;
+	uint32_t last;		/* the line in which it was last used */
+	uint32_t score;		/* as of that line */
+};
+
+struct tinyrl_usage {
+	struct tinyrl *tinyrl;
+	uint32_t line;		/* lines added */
+	unsigned half_life;
+	size_t mask;		/* sets - 1 */
+	struct usage_word words[];
+};
+
+struct tinyrl_usage *tinyrl_usage_new(struct tinyrl *tinyrl, size_t words,
+				      unsigned half_life)
+{
+	struct tinyrl_usage *usage;
+	size_t size = WAYS;
+
+	while (size < words)
+		size *= 2;
+	usage = tinyrl__malloc(tinyrl, sizeof(*usage)
+			       + size * sizeof(usage->words[0]));
+	if (!usage)
+		return NULL;
+	usage->tinyrl = tinyrl;
+	usage->line = 0;
+	usage->half_life = half_life ? half_life : 1;
+	usage->mask = size / WAYS - 1;
+	memset(usage->words, 0, size * sizeof(usage->words[0]));
+	tinyrl_set_usage(tinyrl, usage);
+	return usage;
+}
+
+void tinyrl_usage_delete(struct tinyrl_usage *usage)
+{
+	/* the instance may have been reset and given another since */
+	if (tinyrl_get_usage(usage->tinyrl) == usage)
+		tinyrl_set_usage(usage->tinyrl, NULL);
+	tinyrl__free(usage->tinyrl, usage);
+}
+
+/* FNV-1a */
+static uint32_t usage_hash(const char *word, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char)word[i]) * 16777619u;
+	return hash ? hash : 1;
+}
+
+/* the first of the places which a word may have */
+static size_t usage_set(const struct tinyrl_usage *usage, uint32_t hash)
+{
+	return (hash & usage->mask) * WAYS;
+}
+
+/*
+ * A word's score now: halved for each half life since it was last used,
+ * and in between, linearly towards the next halving.
+ */
+static uint32_t usage_decay(const struct tinyrl_usage *usage,
+			    const struct usage_word *word)
+{
+	uint32_t age = usage->line - word->last;
+	uint32_t score;
+
+	if (age / usage->half_life >= 32)
+		return 0;
+	score = word->score >> (age / usage->half_life);
+	return score - (uint64_t)(score / 2) * (age % usage->half_life)
+		/ usage->half_life;
+}
+
+static void usage_add(struct tinyrl_usage *usage, const char *word,
+		      size_t len)
+{
+	uint32_t hash = usage_hash(word, len), score;
+	struct usage_word *set = &usage->words[usage_set(usage, hash)];
+	struct usage_word *victim = set;
+	unsigned i;
+
+	for (i = 0; i < WAYS; i++) {
+		if (set[i].hash == hash) {
+			score = usage_decay(usage, &set[i]);
+			set[i].score = score > UINT32_MAX - USE
+				? UINT32_MAX : score + USE;
+			set[i].last = usage->line;
+			return;
+		}
+		if (usage_decay(usage, &set[i]) < usage_decay(usage, victim))
+			victim = &set[i];
+	}
+
+	/* take the place of the least used */
+	victim->hash = hash;
+	victim->last = usage->line;
+	victim->score = USE;
+}
+
+void tinyrl_usage_add_line(struct tinyrl_usage *usage, const char *line)
+{
+	const char *word;
+
+	usage->line++;
+	for (;;) {
+		while (isspace((unsigned char)*line))
+			line++;
+		if (!*line)
+			break;
+		for (word = line; *line && !isspace((unsigned char)*line);
+		     line++)
+			;
+		usage_add(usage, word, line - word);
+	}
+}
+
+uint32_t tinyrl_usage_score(const struct tinyrl_usage *usage,
+			    const char *word, size_t len)
+{
+	uint32_t hash = usage_hash(word, len);
+	const struct usage_word *set = &usage->words[usage_set(usage, hash)];
+	unsigned i;
+
+	for (i = 0; i < WAYS; i++)
+		if (set[i].hash == hash)
+			return usage_decay(usage, &set[i]);
+	return 0;
+}
@@ -0,0 +1,49 @@
+/**
+  \ingroup tinyrl
+  \defgroup tinyrl_usage usage
+  @{
+
+  \brief This class keeps a model of which words an operator uses, so that
+  completion can offer the most used matches first.
+
+  Each word of an accepted line counts as a use, and a word's score, its
+  "frecency", halves for every half_life lines in which it is not used.
+  The words are kept by hash in a table of fixed size, 12 bytes each,
+  where a new word replaces the lowest scoring of those it competes with.
+
+*/
+#ifndef _tinyrl_usage_h
+#define _tinyrl_usage_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct tinyrl;
+
+/**
+ * Create a model for instance which keeps about words (rounded up to a
+ * power of two), and attach it to the instance.  Memory comes from the
+ * instance's allocator, once, here.
+ */
+struct tinyrl_usage *tinyrl_usage_new(struct tinyrl *tinyrl, size_t words,
+				      unsigned half_life);
+
+/**
+ * Detach the model from its instance, if it is still attached, and free
+ * it.  This must be done before the instance is deleted, or put in a pool
+ * which may delete it.
+ */
+void tinyrl_usage_delete(struct tinyrl_usage *usage);
+
+/* count a use of each word of line, as tinyrl_history_add() does */
+void tinyrl_usage_add_line(struct tinyrl_usage *usage, const char *line);
+
+/**
+ * The score of a word, in 256ths of a use, or 0 if it has not been used
+ * recently enough to be kept.
+ */
+uint32_t tinyrl_usage_score(const struct tinyrl_usage *usage,
+			    const char *word, size_t len);
+
+#endif				/* _tinyrl_usage_h */
+/** @} tinyrl_usage */
@@ -0,0 +1,463 @@
+/*
+ * vt100.c
+ *
+ * A headless terminal model
+ */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utf8.h"
+#include "vt100.h"
+
+/* room for a character and a few combining marks */
+#define CELL_BYTES 16
+#define MAX_PARAMS 8
+
+#define ATTR_BOLD 0x01
+#define ATTR_UNDERLINE 0x02
+#define ATTR_REVERSE 0x04
+#define ATTR_DIM 0x08
+#define ATTR_FG(colour) (((colour) + 1) << 4)
+#define ATTR_FG_MASK 0xf0
+#define ATTR_BG(colour) (((colour) + 1) << 8)
+#define ATTR_BG_MASK 0xf00
+
+struct cell {
+	char text[CELL_BYTES];	/* empty for a blank */
+	unsigned char width;	/* 0 for the right half of a wide character */
+	unsigned short attr;
+};
+
+enum state {
+	STATE_GROUND,
+	STATE_ESCAPE,
+	STATE_CSI,
+};
+
+struct vt100 {
+	unsigned rows;
+	unsigned cols;
+	unsigned row;
+	unsigned col;
+	bool wrap_pending;
+	unsigned long scrolled;
+	unsigned short pen;	/* the attributes which are drawn with */
+
+	/* the parser */
+	enum state state;
+	unsigned params[MAX_PARAMS];
+	unsigned nparams;
+	char utf8[4];
+	size_t utf8_len;
+	size_t utf8_need;
+
+	struct vt100_stats frame;
+	struct vt100_stats total;
+	struct cell cells[];
+};
+
+static struct cell *cell_at(struct vt100 *vt, unsigned row, unsigned col)
+{
+	return &vt->cells[row * vt->cols + col];
+}
+
+static void clear_cells(struct vt100 *vt, unsigned row, unsigned from,
+			unsigned to)
+{
+	unsigned col;
+
+	for (col = from; col < to; col++) {
+		cell_at(vt, row, col)->text[0] = '\0';
+		cell_at(vt, row, col)->width = 1;
+		cell_at(vt, row, col)->attr = 0;
+	}
+}
+
+struct vt100 *vt100_new(unsigned rows, unsigned cols)
+{
+	struct vt100 *vt;
+	unsigned row;
+
+	vt = calloc(1, sizeof(*vt) + rows * cols * sizeof(struct cell));
+	if (!vt)
+		return NULL;
+	vt->rows = rows;
+	vt->cols = cols;
+	for (row = 0; row < rows; row++)
+		clear_cells(vt, row, 0, cols);
+	return vt;
+}
+
+void vt100_delete(struct vt100 *vt)
+{
+	free(vt);
+}
+
+static void line_feed(struct vt100 *vt)
+{
+	if (vt->row + 1 < vt->rows) {
+		vt->row++;
+		return;
+	}
+	memmove(vt->cells, vt->cells + vt->cols,
+		(vt->rows - 1) * vt->cols * sizeof(struct cell));
+	clear_cells(vt, vt->rows - 1, 0, vt->cols);
+	vt->scrolled++;
+}
+
+/* make sure no half of a wide character is left behind at col */
+static void split_wide(struct vt100 *vt, unsigned row, unsigned col)
+{
+	struct cell *cell = cell_at(vt, row, col);
+
+	if (cell->width == 0 && col > 0)
+		clear_cells(vt, row, col - 1, col);
+	else if (cell->width == 2 && col + 1 < vt->cols)
+		clear_cells(vt, row, col + 1, col + 2);
+}
+
+static void draw(struct vt100 *vt, const char *s, size_t len)
+{
+	size_t width = utf8_char_width(s, len, 0);
+	struct cell *cell;
+	size_t used;
+
+	if (width == 0) {
+		/* combine with the character before the cursor, as xterm does */
+		if (vt->wrap_pending)
+			cell = cell_at(vt, vt->row, vt->col);
+		else if (vt->col > 0)
+			cell = cell_at(vt, vt->row, vt->col - 1);
+		else
+			return;
+		if (cell->width == 0)
+			cell--;
+		used = strlen(cell->text);
+		if (used + len < CELL_BYTES) {
+			memcpy(cell->text + used, s, len);
+			cell->text[used + len] = '\0';
+		}
+		return;
+	}
+
+	if (vt->wrap_pending || vt->col + width > vt->cols) {
+		vt->col = 0;
+		line_feed(vt);
+	}
+	vt->wrap_pending = false;
+
+	split_wide(vt, vt->row, vt->col);
+	if (width == 2)
+		split_wide(vt, vt->row, vt->col + 1);
+	cell = cell_at(vt, vt->row, vt->col);
+	memcpy(cell->text, s, len);
+	cell->text[len] = '\0';
+	cell->width = width;
+	cell->attr = vt->pen;
+	if (width == 2) {
+		cell[1].text[0] = '\0';
+		cell[1].width = 0;
+		cell[1].attr = vt->pen;
+	}
+	vt->frame.cells++;
+
+	vt->col += width;
+	if (vt->col >= vt->cols) {
+		vt->col = vt->cols - 1;
+		vt->wrap_pending = true;
+	}
+}
+
+static unsigned param(const struct vt100 *vt, unsigned i, unsigned def)
+{
+	return i < vt->nparams && vt->params[i] ? vt->params[i] : def;
+}
+
+static void move_to(struct vt100 *vt, unsigned row, unsigned col)
+{
+	vt->row = row < vt->rows ? row : vt->rows - 1;
+	vt->col = col < vt->cols ? col : vt->cols - 1;
+	vt->wrap_pending = false;
+}
+
+/* SGR: bold, underline, reverse and the foreground and background colours */
+static void sgr(struct vt100 *vt)
+{
+	unsigned i, p;
+
+	if (!vt->nparams)
+		vt->pen = 0;
+	for (i = 0; i < vt->nparams; i++) {
+		p = vt->params[i];
+		if (p == 0)
+			vt->pen = 0;
+		else if (p == 1)
+			vt->pen |= ATTR_BOLD;
+		else if (p == 2)
+			vt->pen |= ATTR_DIM;
+		else if (p == 4)
+			vt->pen |= ATTR_UNDERLINE;
+		else if (p == 7)
+			vt->pen |= ATTR_REVERSE;
+		else if (p == 22)
+			vt->pen &= ~(ATTR_BOLD | ATTR_DIM);
+		else if (p == 24)
+			vt->pen &= ~ATTR_UNDERLINE;
+		else if (p == 27)
+			vt->pen &= ~ATTR_REVERSE;
+		else if (p >= 30 && p <= 37)
+			vt->pen = (vt->pen & ~ATTR_FG_MASK) | ATTR_FG(p - 30);
+		else if (p == 39)
+			vt->pen &= ~ATTR_FG_MASK;
+		else if (p >= 40 && p <= 47)
+			vt->pen = (vt->pen & ~ATTR_BG_MASK) | ATTR_BG(p - 40);
+		else if (p == 49)
+			vt->pen &= ~ATTR_BG_MASK;
+		else
+			vt->frame.unknown++;
+	}
+}
+
+static void csi(struct vt100 *vt, char final)
+{
+	unsigned n = param(vt, 0, 1);
+	unsigned row;
+
+	switch (final) {
+	case 'A':
+		move_to(vt, vt->row > n ? vt->row - n : 0, vt->col);
+		break;
+	case 'B':
+		move_to(vt, vt->row + n, vt->col);
+		break;
+	case 'C':
+		move_to(vt, vt->row, vt->col + n);
+		break;
+	case 'D':
+		move_to(vt, vt->row, vt->col > n ? vt->col - n : 0);
+		break;
+	case 'H':
+	case 'f':
+		move_to(vt, param(vt, 0, 1) - 1, param(vt, 1, 1) - 1);
+		break;
+	case 'J':
+		switch (param(vt, 0, 0)) {
+		case 0:
+			clear_cells(vt, vt->row, vt->col, vt->cols);
+			for (row = vt->row + 1; row < vt->rows; row++)
+				clear_cells(vt, row, 0, vt->cols);
+			break;
+		case 1:
+			for (row = 0; row < vt->row; row++)
+				clear_cells(vt, row, 0, vt->cols);
+			clear_cells(vt, vt->row, 0, vt->col + 1);
+			break;
+		default:
+			for (row = 0; row < vt->rows; row++)
+				clear_cells(vt, row, 0, vt->cols);
+			break;
+		}
+		break;
+	case 'K':
+		split_wide(vt, vt->row, vt->col);
+		switch (param(vt, 0, 0)) {
+		case 0:
+			clear_cells(vt, vt->row, vt->col, vt->cols);
+			break;
+		case 1:
+			clear_cells(vt, vt->row, 0, vt->col + 1);
+			break;
+		default:
+			clear_cells(vt, vt->row, 0, vt->cols);
+			break;
+		}
+		break;
+	case 'm':
+		sgr(vt);
+		break;
+	default:
+		vt->frame.unknown++;
+		break;
+	}
+}
+
+static void control(struct vt100 *vt, char c)
+{
+	switch (c) {
+	case '\r':
+		vt->col = 0;
+		vt->wrap_pending = false;
+		break;
+	case '\n':
+		vt->col = 0;
+		vt->wrap_pending = false;
+		line_feed(vt);
+		break;
+	case '\b':
+		if (vt->col > 0 && !vt->wrap_pending)
+			vt->col--;
+		vt->wrap_pending = false;
+		break;
+	case '\t':
+		move_to(vt, vt->row, (vt->col + 8) & ~7u);
+		break;
+	case '\a':
+		vt->frame.bells++;
+		break;
+	case '\x1b':
+		vt->state = STATE_ESCAPE;
+		break;
+	default:
+		break;
+	}
+}
+
+static void feed(struct vt100 *vt, char c)
+{
+	unsigned char u = c;
+
+	switch (vt->state) {
+	case STATE_ESCAPE:
+		vt->frame.escapes++;
+		if (c == '[') {
+			vt->state = STATE_CSI;
+			vt->nparams = 0;
+			memset(vt->params, 0, sizeof(vt->params));
+		} else {
+			vt->frame.unknown++;
+			vt->state = STATE_GROUND;
+		}
+		return;
+	case STATE_CSI:
+		if (c >= '0' && c <= '9') {
+			if (!vt->nparams)
+				vt->nparams = 1;
+			if (vt->nparams <= MAX_PARAMS)
+				vt->params[vt->nparams - 1] =
+					vt->params[vt->nparams - 1] * 10 + c - '0';
+		} else if (c == ';') {
+			if (!vt->nparams)
+				vt->nparams = 1;
+			vt->nparams++;
+		} else if (u >= 0x40 && u <= 0x7e) {
+			if (vt->nparams > MAX_PARAMS)
+				vt->nparams = MAX_PARAMS;
+			csi(vt, c);
+			vt->state = STATE_GROUND;
+		}
+		return;
+	case STATE_GROUND:
+		break;
+	}
+
+	if (vt->utf8_need) {
+		vt->utf8[vt->utf8_len++] = c;
+		if (vt->utf8_len == vt->utf8_need) {
+			draw(vt, vt->utf8, vt->utf8_len);
+			vt->utf8_need = 0;
+		}
+		return;
+	}
+	if (u < 0x20 || u == 0x7f) {
+		control(vt, c);
+		return;
+	}
+	vt->utf8_need = utf8_char_len(c);
+	if (vt->utf8_need <= 1) {
+		vt->utf8_need = 0;
+		draw(vt, &c, 1);
+		return;
+	}
+	vt->utf8[0] = c;
+	vt->utf8_len = 1;
+}
+
+void vt100_write(void *context, const char *buf, size_t len)
+{
+	struct vt100 *vt = context;
+	size_t i;
+
+	memset(&vt->frame, 0, sizeof(vt->frame));
+	vt->frame.frames = 1;
+	vt->frame.bytes = len;
+	for (i = 0; i < len; i++)
+		feed(vt, buf[i]);
+
+	vt->total.frames += vt->frame.frames;
+	vt->total.bytes += vt->frame.bytes;
+	vt->total.escapes += vt->frame.escapes;
+	vt->total.cells += vt->frame.cells;
+	vt->total.bells += vt->frame.bells;
+	vt->total.unknown += vt->frame.unknown;
+}
+
+void vt100_get_cursor(const struct vt100 *vt, unsigned *row, unsigned *col)
+{
+	*row = vt->row;
+	*col = vt->wrap_pending ? vt->cols : vt->col;
+}
+
+unsigned long vt100_scrolled(const struct vt100 *vt)
+{
+	return vt->scrolled;
+}
+
+size_t vt100_get_row(const struct vt100 *vt, unsigned row,
+		     char *buf, size_t size)
+{
+	const struct cell *cell = &vt->cells[row * vt->cols];
+	size_t len = 0, trimmed = 0, n;
+	unsigned col;
+
+	for (col = 0; col < vt->cols; col++, cell++) {
+		if (cell->width == 0)
+			continue;
+		if (cell->text[0]) {
+			n = strlen(cell->text);
+			if (len + n >= size)
+				break;
+			memcpy(buf + len, cell->text, n);
+			len += n;
+			trimmed = len;
+		} else {
+			if (len + 1 >= size)
+				break;
+			buf[len++] = ' ';
+		}
+	}
+	buf[trimmed] = '\0';
+	return trimmed;
+}
+
+unsigned vt100_get_attr(const struct vt100 *vt, unsigned row, unsigned col)
+{
+	return vt->cells[row * vt->cols + col].attr;
+}
+
+unsigned vt100_get_pen(const struct vt100 *vt)
+{
+	return vt->pen;
+}
+
+void vt100_get_stats(const struct vt100 *vt, struct vt100_stats *frame,
+		     struct vt100_stats *total)
+{
+	if (frame)
+		*frame = vt->frame;
+	if (total)
+		*total = vt->total;
+}
+
+void vt100_print(const struct vt100 *vt, FILE *stream)
+{
+	char buf[CELL_BYTES * 512];
+	unsigned row, col;
+
+	vt100_get_cursor(vt, &row, &col);
+	fprintf(stream, "cursor %u,%u\n", row, col);
+	for (row = 0; row < vt->rows; row++) {
+		vt100_get_row(vt, row, buf, sizeof(buf));
+		fprintf(stream, "|%s\n", buf);
+	}
+}
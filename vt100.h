@@ -0,0 +1,78 @@
+/**
+  \ingroup tinyrl
+  \defgroup tinyrl_vt100 vt100
+  @{
+
+  \brief A headless model of a VT100 style terminal, for checking what
+  tinyrl draws and counting what it costs.  It is not part of the library.
+
+  It understands what tinyrl emits: printable UTF-8 (with wide and
+  combining characters, and xterm's deferred wrapping at the last column),
+  CR, LF (as CR LF, which the terminal driver's ONLCR makes it), BS, TAB,
+  BEL, cursor movement (CSI A B C D H f), erasure (CSI J K) and SGR (CSI m,
+  with bold, underline, reverse and the eight colours kept for each cell).
+  Anything else is counted as unknown.
+
+*/
+#ifndef _tinyrl_vt100_h
+#define _tinyrl_vt100_h
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+struct vt100;
+
+struct vt100_stats {
+	unsigned long frames;	/* calls to vt100_write() */
+	unsigned long bytes;
+	unsigned long escapes;	/* escape sequences */
+	unsigned long cells;	/* characters drawn */
+	unsigned long bells;
+	unsigned long unknown;	/* unsupported sequences */
+};
+
+struct vt100 *vt100_new(unsigned rows, unsigned cols);
+void vt100_delete(struct vt100 *vt);
+
+/**
+ * Feed output to the terminal as one frame.  This is a
+ * tinyrl_write_func_t, with the terminal as the context.
+ */
+void vt100_write(void *context, const char *buf, size_t len);
+
+/**
+ * The cursor position, from 0.  The column is the width of the screen
+ * while a wrap is pending after drawing in the last column.
+ */
+void vt100_get_cursor(const struct vt100 *vt, unsigned *row, unsigned *col);
+
+/**
+ * The attributes a cell was drawn with, and those the next will be, which
+ * are equal if SGR set them the same way.  0 is the default.
+ */
+unsigned vt100_get_attr(const struct vt100 *vt, unsigned row, unsigned col);
+unsigned vt100_get_pen(const struct vt100 *vt);
+
+/* the number of lines scrolled off the top of the screen */
+unsigned long vt100_scrolled(const struct vt100 *vt);
+
+/**
+ * Copy the text of a row, without trailing blanks, to buf as a string.
+ * The result is the length of the text.
+ */
+size_t vt100_get_row(const struct vt100 *vt, unsigned row,
+		     char *buf, size_t size);
+
+/**
+ * Statistics for the most recent frame, and totals since the terminal
+ * was created.  Either pointer may be NULL.
+ */
+void vt100_get_stats(const struct vt100 *vt, struct vt100_stats *frame,
+		     struct vt100_stats *total);
+
+/* print the screen, with the cursor position */
+void vt100_print(const struct vt100 *vt, FILE *stream);
+
+#endif				/* _tinyrl_vt100_h */
+/** @} tinyrl_vt100 */